@@ -0,0 +1,178 @@
+; Bignum arithmetic against results computed elsewhere. Run with:
+; ./scheme bignum-test.scm, every line should say ok. Results that fit a
+; fixnum have to be one, eqv? on a fixnum and a bignum is #f.
+
+(define check (lambda (name got expected)
+                (begin
+                  (display (if (eqv? got expected) "ok   " "FAIL "))
+                  (display name)
+                  (display ": ")
+                  (write got)
+                  (newline))))
+
+; the edges of the fixnum range, 2^62
+(check "2^62 - 1 + 1"
+       (+ 4611686018427387903 1)
+       4611686018427387904)
+(check "-2^62 - 1"
+       (- -4611686018427387904 1)
+       -4611686018427387905)
+(check "2^31 * 2^31"
+       (* 2147483648 2147483648)
+       4611686018427387904)
+(check "2^62 / 2 is a fixnum"
+       (/ 4611686018427387904 2)
+       2305843009213693952)
+(check "-2^62 / -1"
+       (/ -4611686018427387904 -1)
+       4611686018427387904)
+(check "2^64 - (2^64 - 1) is a fixnum"
+       (- 18446744073709551616 18446744073709551615)
+       1)
+
+; products of mixed sign, below and above KARATSUBA_THRESHOLD (32 digits)
+(check "2 x 2 digits"
+       (* 16933993924898988295
+          -16934665939211030712)
+       -286771530134793413889871292032973516040)
+(check "31 x 31 digits"
+       (* -22699885472651566633180464702284512576276787149756655911947685820539660579228934052601128515413350170771252847251787828006372635310317646923765996828428243710185807325128020952625517614726494672105571355017776110914267623337926371489604894995976293880454058627431031147732216852083969286563527875383
+          27670814105552172417654487834195524392317491513109414471172363049271973890101018556012341578453843423693017155034251903534604774272068103193409604240937628681432244902938106956109141239326882151759631065341369933916418055799606120682057589491640521713364495554900083213443935109620741713843126127108)
+       -628124311131065812385671365520590897305707041032513176999266290369503873654398561543573962507803051619754086827747017620143345512073305067316876704499592894360485721172741331457188443319508215045579086588901925901941523031911128927521345108561688427654244467421234380098713433897311745561576829636297887572728232704410559902724761056645737258184898316931641256483917880996327307817985265995435619036993527521402298898915621233072416651549078622418053535325776152545877693992639248613660795092084875748462016375334737339192378240567007681129347407561673165271477134719291021827823031056068442182364)
+(check "32 x 32 digits"
+       (* 100692924766329218529617171154407944068080632054893507384824824732402188325664646963968681771945468659765037812976659096675670952246866709211253809497788656198109171862663591881093359230711186838565708060637591528075402125003481774884297520819549212016050089548407571693800037478527797272582722181524261703542
+          90393761895004647195923655715799708243247696699195211099726335473929921750220903556446279682643286589394099218421890936186614624196247939468241338553082019000472957720058115342904960091777507904628598098098633323960600076512909729930325903852249741971257891022533343756933279849186998285927176694821559498214)
+       9102012265839179832697151631648728704294979659362498446839898662718347627667147394010682100072794164789943724598067402087805590780750325876658847870695163882076490550111267602853093456747970959946798759179876761722949142170681794744952545316976404150073542088705113552483326359910272901439522439726952113790956443464612324921312641148107897107624106570228192953246821464125204906844422666573782564175249685715020460508609984348250535344361365666780091748392167083262187626223053735859747942972312087918106532879806174644692489663083652426868143530039194692386597664334696812855812270111444287810119516976782346473988)
+(check "33 x 33 digits"
+       (* -628257265539541902681820202911159469768667828322041673982582676379986361728716493754304689664197853991054080216673802073948894136840771055445633463336162288225913267422437032091414710329119507999216488680175776995232058567503516998866490273754605022110052193301435934862928183431189477971531863525573230794291983780415
+          -433780576754635942994444449719354429666756897310882084141243207247101490026871691994577265638285051935596508953587692157306938707282489219567864257989405981682832064171765782412592502107949913612766877528607671478475533831471557389689963977029630117625352837073584482206470016648889033587865161972400578332612595839861)
+       272525798996032951344999205037663428783629007513777953079541078517060681627775907856692434546639396085019106431349794130773854758784965787715975937113720049118033810618603097924165145929827130678129145257221331531802855286756704323717464513483404354055227632482848765468725134863103771077751521783268352401724464740950905320844483817083195982578615618473278956843429193885406326197129982972180119007633679907125317889804938538194555704519791314991037373397509800615752033210740564401579255190156028214533063701878569894360001249450338330257502357695457451184032819115183163221584675362622656935091431550460340131998180896603116728122315)
+(check "70 x 40 digits"
+       (* 126964764974431981529854868931143555469315535914438700738175434173996299347871082456238580880886600453952896186181963258843088127650577141683814751589458266266155828039141427569369285498503528550153516514443865303060968977226981120601292715621179562031716861199676022594013841424242438507952310745935389411843597132611063137722217196986979594343339246036514475218472311786225194616350203937519180540816357015539932315665391510745543579622283361119429019989659270734735812539573667939410005837887662739557762562760679744594772359543836063812331797081150760145451170988507974139444239687549098294512524843243753565519573803733630063614286272080877975441015324735888623983915737
+          -19610429637337471311312515175201121038790603230792676081853695844970690001902381676535930779991749041481219113392016877825462994134047471258786172085697117296160544285965540682841125830708891243516026544057411323083204820387513655178149550623886165244775372314543774417458253847366285748117557568424830936504986225709567543424399994898779261265260428066509559425040287326414290604763953)
+       -2489833589952187443560109380053609767389806933054396082216015119482538549697230544291493493883052780018141888850768531589180006444623285974719982759964179404717638253574306520434571147710659359111209067285758394603181429329861270884021835293877555320192765556929480705963398733793381808201543819549104505304786897227536689490301738547185260597290297095597949309160225231273840535171347787176409956351082155721088425596842723099682573489232217374722786974499299661966701910252397635631260487559496605644432114393396005803491157550026749283658820169265768333993142462690581515940349125816901833195050402540469892745982265731384182623607363426189430544690672837102829963406962841275787468305507137489236047756016586468508379185002141718010300995421990105944975394771479603999505023929791125109912387200197647247397400595587067791978046419546874124512735855482629164791442789079700608304722336921783062147365399736441950958713272361333503342707429249740787982757130643050329752014901095799847598692356939196628668332599671464548940318480075938030920925219527028361)
+(check "100 x 1 digits"
+       (* -1932407558102027174221255087338399331700813287701312431092670518099539438826843921248547712073236797054636040017178443791405422726731636893917307701866767659013010817441472675097489111420731406283901895799120696385152404828449871302839188809899078269127804551082286635449008566578055704948401252269635871744904195399388923508483194046272546243659050238966995459426409220039692232543558113900123220367795653456930996551370946879816362759943254918494821536250066442095081906578217257344616956765971319880321250335651522226059683745187654812986490583253650687845615066964559284548548647063049180067612668848406759421621268966503183286782890100117885120551222854948875959534451971936935472516757329760940227065846493578091326487451980070991912129504374386479306360485804252098980739642119384047923621744108442249753103863549614418001012433908131086574736769461073385891058590006570546436002618575796032160681005993355034838147811342264247138189649977587389964149313361
+          -4071881902)
+       7868535363123657920223729533858657588401436504872093269813867167498478075494261874710674672574519812487219396542896674378748003945638043879177379115796502845973985930070158529956991998436137720850429203447929391124338898732742445672260054131388975250542992676545197463661289626092147095327246902950866730288068553970643419493455061308171331609013368926558483986554571003925558523344089710675166376585584904945541061320351771888527616605679710249591548894176482491864494978603497597605622363377675066871732905187750858731043179013873191226822885576443964511268411361231507026159303476342615409253251162629746665223367632602978556250840126001924984488887612607035099154871219330018219435882802562779418497093190899510789296027428947745136642188503142294137441066775634262036485186395319876828127696058128841122181827590313952427736585547307490102067265821982491013503663616269392669119009663803392878598486944299495898618033572205476115623649728787452798818436017900382692622)
+
+; quotients truncate, remainders take the sign of the dividend
+(check "1 digit divisor, quotient"
+       (/ 1105216094569890197843645101242001125179472150088165741415334291497499634478428087505482316153917
+          -2203348084)
+       -501607577393518271643022474537891093007831871057267654771216934735355974956532600005420)
+(check "1 digit divisor, remainder"
+       (modulo 1105216094569890197843645101242001125179472150088165741415334291497499634478428087505482316153917
+          -2203348084)
+       1769538637)
+(check "2 digit divisor, quotient"
+       (/ -464458072821580624083560261528306000499583799771250039975226298545091734102965488702312
+          13780767847775150619)
+       -33703352233494413479861013319800814433585817702248667667705692401868)
+(check "2 digit divisor, remainder"
+       (modulo -464458072821580624083560261528306000499583799771250039975226298545091734102965488702312
+          13780767847775150619)
+       -9643189637911746020)
+(check "40 by 20 digits, quotient"
+       (/ -14550829730230084299785868868407948050260493764044163550456526482109081672743089966871100341870136953734026732926673149189239195994504893592948413689993984993598198825324696096718476043578011933400414184444160200063137974979954277934286573327164542062702891215324673053159698072686171433484732331560355553189599647492686311585781002631975528793100290226831240203851990619880019689509028
+          -3707513436756099858746050531397054838164199951900954876813916845113294113033645712818504810222101424104630524315114241209326458069043176173846259176105880653513396395950648329645538380984660897)
+       3924686984536292594882861816603854613628639788935075509220510115873803999226896821638714816618262413081063567302696001014814262021481586462790946087871893293319296653894305154787294126123075120)
+(check "40 by 20 digits, remainder"
+       (modulo -14550829730230084299785868868407948050260493764044163550456526482109081672743089966871100341870136953734026732926673149189239195994504893592948413689993984993598198825324696096718476043578011933400414184444160200063137974979954277934286573327164542062702891215324673053159698072686171433484732331560355553189599647492686311585781002631975528793100290226831240203851990619880019689509028
+          -3707513436756099858746050531397054838164199951900954876813916845113294113033645712818504810222101424104630524315114241209326458069043176173846259176105880653513396395950648329645538380984660897)
+       -293515683404319609386791076144539731513456031016872886263174012171433175850771213566281209540043910706449085426912103610621880492627821891375289666566144134394518077368791038605596139631926388)
+(check "70 by 35 digits, quotient"
+       (/ 156687211706054754281474574780537303199020479855388776956753142629496540113300896014819907134148890010284601783244512630728930511771263649952916915711801779208742529170410508922479863066332868208115109683561114954879376206694469903635294088947510378480802644507405451046947528101483680646558288669330748888818202498085994515500747372852297596851616548458843525516084407702802012824857510123892734740166066791006296040679570379219691851984603087960404266840998676946862451058813777898818965283760422362758620731690366962852084568962860044210633482995768103091519805174488462817144408074499663516025088645043263793002678638623751827910905449355210127681977008248127864778040621
+          12399392973489298602737742116713492779769307810274262979189052470468480687066650340981873100001561041320607389870756319035314652444747356066555382735597342407530533954029381409414713210224056627656794759776072392370495427276264135609093730674490797751033091990046850804995956122835839466131414998399936993767084798707737414893091868202905)
+       12636684073249562490593972740954051873235291235845741716743779621884017046785861113652062008981860153852861649615822951412795986677450630953011419578237659923854337147040685283822319061005392244204074836290118508264996781503440121532668965566828159933895289358003756900923732971091935011720276560684715312579842987613260081310844145040175)
+(check "70 by 35 digits, remainder"
+       (modulo 156687211706054754281474574780537303199020479855388776956753142629496540113300896014819907134148890010284601783244512630728930511771263649952916915711801779208742529170410508922479863066332868208115109683561114954879376206694469903635294088947510378480802644507405451046947528101483680646558288669330748888818202498085994515500747372852297596851616548458843525516084407702802012824857510123892734740166066791006296040679570379219691851984603087960404266840998676946862451058813777898818965283760422362758620731690366962852084568962860044210633482995768103091519805174488462817144408074499663516025088645043263793002678638623751827910905449355210127681977008248127864778040621
+          12399392973489298602737742116713492779769307810274262979189052470468480687066650340981873100001561041320607389870756319035314652444747356066555382735597342407530533954029381409414713210224056627656794759776072392370495427276264135609093730674490797751033091990046850804995956122835839466131414998399936993767084798707737414893091868202905)
+       273222122770790441761507868092996745771536778087550760820269238689179766139091300162399023033183645300642467738342358777441117680392209951272172714118942124447100171241249204220720776280456067194349520122878878556456959542978841954535325440870349183242040470123064450321642015391258788609345134240038347954010855373451628470818501332246)
+(check "equal sizes, quotient"
+       (/ 927983793459672278030156610335908844537200177001
+          -1362359525087200468326050532947020259866814897191)
+       0)
+(check "equal sizes, remainder"
+       (modulo 927983793459672278030156610335908844537200177001
+          -1362359525087200468326050532947020259866814897191)
+       927983793459672278030156610335908844537200177001)
+(check "divisor larger, quotient"
+       (/ -43508869004269223555669411526
+          307265007267867970494961678421116275366)
+       0)
+(check "divisor larger, remainder"
+       (modulo -43508869004269223555669411526
+          307265007267867970494961678421116275366)
+       -43508869004269223555669411526)
+(check "add back step, quotient"
+       (/ 1461501636990620551163904125463065161770876272639
+          79228162514264337587101499393)
+       18446744069414584319)
+(check "add back step, remainder"
+       (modulo 1461501636990620551163904125463065161770876272639
+          79228162514264337587101499393)
+       79228162449700733344150454272)
+
+; a product divided by one factor gives the other back
+(check "(a * b) / b across the threshold"
+       (/ (* -23972033631409626921717459033495619606445383778009316892913126932102824823900993881046306612797395177504736225743774376590280577999625131778417317105686866535788481096987607243483792971535568495372986468666344059853170782889953358215285312912287917322699445754704884633916463209714944617596600609244567288102626468576938564141040360322006399433928812183966553488123391520917626238898489517646480646914805357938434553531439101986608915
+             788739754082660393326295031379795703168120632461657701974871717559650517796080178708268306009139648644032128343099338904051242249278635174111026696441442084575002861219525380514654454525405945859811300797385991793898913025559552034217405441376049246412396360366857402612648064277511013318935310406823207263755096131606105372347320809752928577356220614245009743999581)
+          788739754082660393326295031379795703168120632461657701974871717559650517796080178708268306009139648644032128343099338904051242249278635174111026696441442084575002861219525380514654454525405945859811300797385991793898913025559552034217405441376049246412396360366857402612648064277511013318935310406823207263755096131606105372347320809752928577356220614245009743999581)
+       -23972033631409626921717459033495619606445383778009316892913126932102824823900993881046306612797395177504736225743774376590280577999625131778417317105686866535788481096987607243483792971535568495372986468666344059853170782889953358215285312912287917322699445754704884633916463209714944617596600609244567288102626468576938564141040360322006399433928812183966553488123391520917626238898489517646480646914805357938434553531439101986608915)
+(check "(a * b) mod b"
+       (modulo (* -23972033631409626921717459033495619606445383778009316892913126932102824823900993881046306612797395177504736225743774376590280577999625131778417317105686866535788481096987607243483792971535568495372986468666344059853170782889953358215285312912287917322699445754704884633916463209714944617596600609244567288102626468576938564141040360322006399433928812183966553488123391520917626238898489517646480646914805357938434553531439101986608915
+                  788739754082660393326295031379795703168120632461657701974871717559650517796080178708268306009139648644032128343099338904051242249278635174111026696441442084575002861219525380514654454525405945859811300797385991793898913025559552034217405441376049246412396360366857402612648064277511013318935310406823207263755096131606105372347320809752928577356220614245009743999581)
+          788739754082660393326295031379795703168120632461657701974871717559650517796080178708268306009139648644032128343099338904051242249278635174111026696441442084575002861219525380514654454525405945859811300797385991793898913025559552034217405441376049246412396360366857402612648064277511013318935310406823207263755096131606105372347320809752928577356220614245009743999581)
+       0)
+
+; decimal conversion, 9 digits a step: literals of 9k-1, 9k and 9k+1
+; digits, each printed back with nine zeros appended
+(check "17 digits times 10^9"
+       (* 37891284364251837 1000000000)
+       37891284364251837000000000)
+(check "17 digits, negated"
+       (- 0 37891284364251837)
+       -37891284364251837)
+(check "18 digits times 10^9"
+       (* 588234545679360088 1000000000)
+       588234545679360088000000000)
+(check "18 digits, negated"
+       (- 0 588234545679360088)
+       -588234545679360088)
+(check "19 digits times 10^9"
+       (* 3993873036379961896 1000000000)
+       3993873036379961896000000000)
+(check "19 digits, negated"
+       (- 0 3993873036379961896)
+       -3993873036379961896)
+(check "26 digits times 10^9"
+       (* 43070810307553586766698668 1000000000)
+       43070810307553586766698668000000000)
+(check "26 digits, negated"
+       (- 0 43070810307553586766698668)
+       -43070810307553586766698668)
+(check "27 digits times 10^9"
+       (* 759265338396197064079740719 1000000000)
+       759265338396197064079740719000000000)
+(check "27 digits, negated"
+       (- 0 759265338396197064079740719)
+       -759265338396197064079740719)
+(check "28 digits times 10^9"
+       (* 7363834502145661678622903549 1000000000)
+       7363834502145661678622903549000000000)
+(check "28 digits, negated"
+       (- 0 7363834502145661678622903549)
+       -7363834502145661678622903549)
+(check "300 digits times 10^9"
+       (* 725402480425172031623251392165483077467157045500373488069134900955463445934077925916989614824647772432281744266443091938964063373119163206552209237690630169175007252998624941388487318578444506791946006169838233823718951479340780710467326018903835539094660185927570579657295065012097826388321661710204 1000000000)
+       725402480425172031623251392165483077467157045500373488069134900955463445934077925916989614824647772432281744266443091938964063373119163206552209237690630169175007252998624941388487318578444506791946006169838233823718951479340780710467326018903835539094660185927570579657295065012097826388321661710204000000000)
+(check "300 digits, negated"
+       (- 0 725402480425172031623251392165483077467157045500373488069134900955463445934077925916989614824647772432281744266443091938964063373119163206552209237690630169175007252998624941388487318578444506791946006169838233823718951479340780710467326018903835539094660185927570579657295065012097826388321661710204)
+       -725402480425172031623251392165483077467157045500373488069134900955463445934077925916989614824647772432281744266443091938964063373119163206552209237690630169175007252998624941388487318578444506791946006169838233823718951479340780710467326018903835539094660185927570579657295065012097826388321661710204)
+(check "301 digits times 10^9"
+       (* 5845880028050829712394720818642031459725021318365003334319858047036978444850787435186669302831574801798499191244954513650128868037877602152514935642147298434587961315399345462380454571769944722664698045467793913558502634349870699461605334987250935538942781870475351451913107201062751346650067483271354 1000000000)
+       5845880028050829712394720818642031459725021318365003334319858047036978444850787435186669302831574801798499191244954513650128868037877602152514935642147298434587961315399345462380454571769944722664698045467793913558502634349870699461605334987250935538942781870475351451913107201062751346650067483271354000000000)
+(check "301 digits, negated"
+       (- 0 5845880028050829712394720818642031459725021318365003334319858047036978444850787435186669302831574801798499191244954513650128868037877602152514935642147298434587961315399345462380454571769944722664698045467793913558502634349870699461605334987250935538942781870475351451913107201062751346650067483271354)
+       -5845880028050829712394720818642031459725021318365003334319858047036978444850787435186669302831574801798499191244954513650128868037877602152514935642147298434587961315399345462380454571769944722664698045467793913558502634349870699461605334987250935538942781870475351451913107201062751346650067483271354)
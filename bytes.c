@@ -0,0 +1,313 @@
+#include "bytes.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BYTES_X86 1
+#include <immintrin.h>
+#endif
+
+#define NOT_FOUND ((size_t)-1)
+
+/* Adler-32 sums are reduced once per block; zlib's NMAX (5552) keeps the
+ * 32 bit sums from overflowing, this is it rounded down to whole 32 byte
+ * vectors. */
+#define ADLER_MOD 65521
+#define ADLER_BLOCK 5536
+
+/* ------------------------------ portable ------------------------------ */
+
+static uint64_t sum_portable(const uint8_t *p, size_t n)
+{
+  uint64_t sum = 0;
+  for (size_t i = 0; i < n; ++i) {
+    sum += p[i];
+  }
+  return sum;
+}
+
+static void xor_portable(uint8_t *dst, const uint8_t *src, size_t n)
+{
+  for (size_t i = 0; i < n; ++i) {
+    dst[i] ^= src[i];
+  }
+}
+
+static uint32_t adler32_portable(uint32_t adler, const uint8_t *p, size_t n)
+{
+  uint32_t a = adler & 0xffff;
+  uint32_t b = adler >> 16;
+  while (n) {
+    size_t k = n < ADLER_BLOCK ? n : ADLER_BLOCK;
+    n -= k;
+    while (k--) {
+      a += *p++;
+      b += a;
+    }
+    a %= ADLER_MOD;
+    b %= ADLER_MOD;
+  }
+  return b << 16 | a;
+}
+
+/* candidates from memchr() on the first byte */
+static size_t find_portable(const uint8_t *p, size_t n,
+    const uint8_t *needle, size_t m)
+{
+  if (m > n) {
+    return NOT_FOUND;
+  }
+  if (m == 0) {
+    return 0;
+  }
+  const uint8_t *end = p + n - m + 1;
+  for (const uint8_t *q = p; (q = memchr(q, needle[0], end - q)); ++q) {
+    if (!memcmp(q + 1, needle + 1, m - 1)) {
+      return q - p;
+    }
+  }
+  return NOT_FOUND;
+}
+
+#ifdef BYTES_X86
+
+/* -------------------------------- sse2 -------------------------------- */
+
+__attribute__((target("sse2")))
+static inline uint32_t hsum_sse2(__m128i v)
+{
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, 0x4e));
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, 0xb1));
+  return (uint32_t)_mm_cvtsi128_si32(v);
+}
+
+/* psadbw against zero adds up 8 bytes into each 64 bit lane */
+__attribute__((target("sse2")))
+static uint64_t sum_sse2(const uint8_t *p, size_t n)
+{
+  __m128i zero = _mm_setzero_si128();
+  __m128i acc = zero;
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+    acc = _mm_add_epi64(acc, _mm_sad_epu8(v, zero));
+  }
+  uint64_t lanes[2];
+  _mm_storeu_si128((__m128i *)lanes, acc);
+  return lanes[0] + lanes[1] + sum_portable(p + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void xor_sse2(uint8_t *dst, const uint8_t *src, size_t n)
+{
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+    __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(d, s));
+  }
+  xor_portable(dst + i, src + i, n - i);
+}
+
+/* Per block of k vectors: s1 adds up the bytes, prior adds up s1 as it
+ * was before each vector, s2 the bytes weighted by their distance from the
+ * end of their vector. A byte then counts into b with its weight plus 16
+ * for every vector after its own. */
+__attribute__((target("sse2")))
+static uint32_t adler32_sse2(uint32_t adler, const uint8_t *p, size_t n)
+{
+  __m128i zero = _mm_setzero_si128();
+  __m128i weights_lo = _mm_set_epi16(9, 10, 11, 12, 13, 14, 15, 16);
+  __m128i weights_hi = _mm_set_epi16(1, 2, 3, 4, 5, 6, 7, 8);
+  uint64_t a = adler & 0xffff;
+  uint64_t b = adler >> 16;
+  while (n >= 16) {
+    size_t k = (n < ADLER_BLOCK ? n : ADLER_BLOCK) / 16;
+    n -= k * 16;
+    b += a * k * 16;
+    __m128i s1 = zero, prior = zero, s2 = zero;
+    while (k--) {
+      __m128i v = _mm_loadu_si128((const __m128i *)p);
+      p += 16;
+      prior = _mm_add_epi32(prior, s1);
+      s1 = _mm_add_epi32(s1, _mm_sad_epu8(v, zero));
+      s2 = _mm_add_epi32(s2,
+          _mm_madd_epi16(_mm_unpacklo_epi8(v, zero), weights_lo));
+      s2 = _mm_add_epi32(s2,
+          _mm_madd_epi16(_mm_unpackhi_epi8(v, zero), weights_hi));
+    }
+    a = (a + hsum_sse2(s1)) % ADLER_MOD;
+    b = (b + 16 * (uint64_t)hsum_sse2(prior) + hsum_sse2(s2)) % ADLER_MOD;
+  }
+  return adler32_portable((uint32_t)(b << 16 | a), p, n);
+}
+
+/* Compare the first and the last byte of the needle at 16 places at once,
+ * memcmp() only where both match. A single byte is left to memchr(). */
+__attribute__((target("sse2")))
+static size_t find_sse2(const uint8_t *p, size_t n,
+    const uint8_t *needle, size_t m)
+{
+  if (m < 2 || m > n) {
+    return find_portable(p, n, needle, m);
+  }
+  __m128i first = _mm_set1_epi8((char)needle[0]);
+  __m128i last = _mm_set1_epi8((char)needle[m - 1]);
+  size_t i = 0;
+  for (; i + 16 <= n - m + 1; i += 16) {
+    __m128i f = _mm_loadu_si128((const __m128i *)(p + i));
+    __m128i l = _mm_loadu_si128((const __m128i *)(p + i + m - 1));
+    unsigned mask = _mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(f, first), _mm_cmpeq_epi8(l, last)));
+    for (; mask; mask &= mask - 1) {
+      size_t at = i + __builtin_ctz(mask);
+      if (!memcmp(p + at + 1, needle + 1, m - 1)) {
+        return at;
+      }
+    }
+  }
+  size_t rest = find_portable(p + i, n - i, needle, m);
+  return rest == NOT_FOUND ? NOT_FOUND : i + rest;
+}
+
+/* -------------------------------- avx2 -------------------------------- */
+
+__attribute__((target("avx2")))
+static inline uint32_t hsum_avx2(__m256i v)
+{
+  return hsum_sse2(_mm_add_epi32(_mm256_castsi256_si128(v),
+        _mm256_extracti128_si256(v, 1)));
+}
+
+__attribute__((target("avx2")))
+static uint64_t sum_avx2(const uint8_t *p, size_t n)
+{
+  __m256i zero = _mm256_setzero_si256();
+  __m256i acc = zero;
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+    acc = _mm256_add_epi64(acc, _mm256_sad_epu8(v, zero));
+  }
+  uint64_t lanes[4];
+  _mm256_storeu_si256((__m256i *)lanes, acc);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3]
+      + sum_portable(p + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void xor_avx2(uint8_t *dst, const uint8_t *src, size_t n)
+{
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+    __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+    _mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(d, s));
+  }
+  xor_portable(dst + i, src + i, n - i);
+}
+
+/* as adler32_sse2(), with pmaddubsw doing the weighting in one step */
+__attribute__((target("avx2")))
+static uint32_t adler32_avx2(uint32_t adler, const uint8_t *p, size_t n)
+{
+  __m256i zero = _mm256_setzero_si256();
+  __m256i ones = _mm256_set1_epi16(1);
+  __m256i weights = _mm256_set_epi8(
+      1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16,
+      17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32);
+  uint64_t a = adler & 0xffff;
+  uint64_t b = adler >> 16;
+  while (n >= 32) {
+    size_t k = (n < ADLER_BLOCK ? n : ADLER_BLOCK) / 32;
+    n -= k * 32;
+    b += a * k * 32;
+    __m256i s1 = zero, prior = zero, s2 = zero;
+    while (k--) {
+      __m256i v = _mm256_loadu_si256((const __m256i *)p);
+      p += 32;
+      prior = _mm256_add_epi32(prior, s1);
+      s1 = _mm256_add_epi32(s1, _mm256_sad_epu8(v, zero));
+      s2 = _mm256_add_epi32(s2,
+          _mm256_madd_epi16(_mm256_maddubs_epi16(v, weights), ones));
+    }
+    a = (a + hsum_avx2(s1)) % ADLER_MOD;
+    b = (b + 32 * (uint64_t)hsum_avx2(prior) + hsum_avx2(s2)) % ADLER_MOD;
+  }
+  return adler32_portable((uint32_t)(b << 16 | a), p, n);
+}
+
+__attribute__((target("avx2")))
+static size_t find_avx2(const uint8_t *p, size_t n,
+    const uint8_t *needle, size_t m)
+{
+  if (m < 2 || m > n) {
+    return find_portable(p, n, needle, m);
+  }
+  __m256i first = _mm256_set1_epi8((char)needle[0]);
+  __m256i last = _mm256_set1_epi8((char)needle[m - 1]);
+  size_t i = 0;
+  for (; i + 32 <= n - m + 1; i += 32) {
+    __m256i f = _mm256_loadu_si256((const __m256i *)(p + i));
+    __m256i l = _mm256_loadu_si256((const __m256i *)(p + i + m - 1));
+    uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(
+          _mm256_cmpeq_epi8(f, first), _mm256_cmpeq_epi8(l, last)));
+    for (; mask; mask &= mask - 1) {
+      size_t at = i + __builtin_ctz(mask);
+      if (!memcmp(p + at + 1, needle + 1, m - 1)) {
+        return at;
+      }
+    }
+  }
+  size_t rest = find_sse2(p + i, n - i, needle, m);
+  return rest == NOT_FOUND ? NOT_FOUND : i + rest;
+}
+
+#endif /* BYTES_X86 */
+
+/* ------------------------------ dispatch ------------------------------ */
+
+uint64_t (*bytes_sum)(const uint8_t *p, size_t n) = sum_portable;
+void (*bytes_xor)(uint8_t *dst, const uint8_t *src, size_t n) = xor_portable;
+uint32_t (*bytes_adler32)(uint32_t adler, const uint8_t *p, size_t n)
+    = adler32_portable;
+size_t (*bytes_find)(const uint8_t *p, size_t n,
+    const uint8_t *needle, size_t m) = find_portable;
+const char *bytes_kernels = "portable";
+
+int bytes_use(const char *name)
+{
+  if (!strcmp(name, "portable")) {
+    bytes_sum = sum_portable;
+    bytes_xor = xor_portable;
+    bytes_adler32 = adler32_portable;
+    bytes_find = find_portable;
+    bytes_kernels = "portable";
+    return 0;
+  }
+#ifdef BYTES_X86
+  __builtin_cpu_init();
+  if (!strcmp(name, "sse2") && __builtin_cpu_supports("sse2")) {
+    bytes_sum = sum_sse2;
+    bytes_xor = xor_sse2;
+    bytes_adler32 = adler32_sse2;
+    bytes_find = find_sse2;
+    bytes_kernels = "sse2";
+    return 0;
+  }
+  if (!strcmp(name, "avx2") && __builtin_cpu_supports("avx2")) {
+    bytes_sum = sum_avx2;
+    bytes_xor = xor_avx2;
+    bytes_adler32 = adler32_avx2;
+    bytes_find = find_avx2;
+    bytes_kernels = "avx2";
+    return 0;
+  }
+#endif
+  return -1;
+}
+
+void bytes_init(void)
+{
+  if (bytes_use("avx2") && bytes_use("sse2")) {
+    bytes_use("portable");
+  }
+}
@@ -0,0 +1,25 @@
+#ifndef BYTES_H
+#define BYTES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Bulk kernels on raw bytes, used by the bytevector primops. Each pointer
+ * starts out at the portable version; bytes_init() points it at the best
+ * one the CPU runs. */
+extern uint64_t (*bytes_sum)(const uint8_t *p, size_t n);
+extern void (*bytes_xor)(uint8_t *dst, const uint8_t *src, size_t n);
+extern uint32_t (*bytes_adler32)(uint32_t adler, const uint8_t *p, size_t n);
+/* offset of the first needle in p, or (size_t)-1 */
+extern size_t (*bytes_find)(const uint8_t *p, size_t n,
+    const uint8_t *needle, size_t m);
+
+/* name of the kernels in use: "avx2", "sse2" or "portable" */
+extern const char *bytes_kernels;
+
+void bytes_init(void);
+/* use the named kernels, -1 if there are none by that name for this CPU */
+int bytes_use(const char *name);
+
+#endif
@@ -0,0 +1,135 @@
+; Bulk bytevector primitives against the same work done on a list of
+; integers by a Scheme loop. Run with: ./scheme bytevector-bench.scm
+; Each line gives the time per call and the result, which has to be the
+; same for both versions.
+
+(define size 100000)
+
+(define time-it (lambda (name reps thunk)
+                  (begin
+                    (define start (current-jiffy))
+                    (define loop (lambda (i result)
+                                   (if (< i reps)
+                                       (loop (+ i 1) (thunk))
+                                       result)))
+                    (define result (loop 0 #f))
+                    (define us (/ (- (current-jiffy) start) reps))
+                    (display name)
+                    (display ": ")
+                    (display us)
+                    (display " us  ")
+                    (write result)
+                    (newline))))
+
+; list helpers
+
+(define reverse (lambda (l)
+                  (begin
+                    (define reverse2 (lambda (l out)
+                                       (if (eq? '() l)
+                                           out
+                                           (reverse2 (cdr l) (cons (car l) out)))))
+                    (reverse2 l '()))))
+
+(define iota-bytes (lambda (n)
+                     (begin
+                       (define iota2 (lambda (i l)
+                                       (if (< i 0)
+                                           l
+                                           (iota2 (- i 1) (cons (modulo (+ (* i 7) 3) 251) l)))))
+                       (iota2 (- n 1) '()))))
+
+(define list-copy (lambda (l) (reverse (reverse l))))
+
+(define make-list (lambda (n x)
+                    (begin
+                      (define make-list2 (lambda (n l)
+                                           (if (= n 0)
+                                               l
+                                               (make-list2 (- n 1) (cons x l)))))
+                      (make-list2 n '()))))
+
+(define list-equal? (lambda (a b)
+                      (if (eq? '() a)
+                          (eq? '() b)
+                          (if (eq? '() b)
+                              #f
+                              (if (= (car a) (car b))
+                                  (list-equal? (cdr a) (cdr b))
+                                  #f)))))
+
+(define list-index (lambda (x l)
+                     (begin
+                       (define index2 (lambda (l i)
+                                        (if (eq? '() l)
+                                            #f
+                                            (if (= (car l) x)
+                                                i
+                                                (index2 (cdr l) (+ i 1))))))
+                       (index2 l 0))))
+
+(define list-sum (lambda (l)
+                   (begin
+                     (define sum2 (lambda (l acc)
+                                    (if (eq? '() l)
+                                        acc
+                                        (sum2 (cdr l) (+ acc (car l))))))
+                     (sum2 l 0))))
+
+(define byte-xor (lambda (a b)
+                   (begin
+                     (define xor2 (lambda (a b bit acc)
+                                    (if (= bit 256)
+                                        acc
+                                        (xor2 (/ a 2) (/ b 2) (* bit 2)
+                                              (if (= (modulo a 2) (modulo b 2))
+                                                  acc
+                                                  (+ acc bit))))))
+                     (xor2 a b 1 0))))
+
+(define list-xor (lambda (a b)
+                   (begin
+                     (define xor-list2 (lambda (a b out)
+                                         (if (eq? '() a)
+                                             (reverse out)
+                                             (xor-list2 (cdr a) (cdr b)
+                                                        (cons (byte-xor (car a) (car b)) out)))))
+                     (xor-list2 a b '()))))
+
+(define list-adler32 (lambda (l)
+                       (begin
+                         (define adler2 (lambda (l a b)
+                                          (if (eq? '() l)
+                                              (+ (* b 65536) a)
+                                              (adler2 (cdr l)
+                                                      (modulo (+ a (car l)) 65521)
+                                                      (modulo (+ b (modulo (+ a (car l)) 65521)) 65521)))))
+                         (adler2 l 1 0))))
+
+; the data: two equal copies, zeros to xor with and a copy with the byte
+; searched for only at the end
+
+(define data (iota-bytes size))
+(define data2 (list-copy data))
+(define key (make-list size 0))
+(define bv (list->bytevector data))
+(define bv2 (bytevector-copy bv))
+(define bv-key (make-bytevector size 0))
+(define needle 255)
+(define data-needle (reverse (cons needle (reverse data))))
+(define bv-needle (list->bytevector data-needle))
+
+(time-it "list copy         " 10 (lambda () (length (list-copy data))))
+(time-it "bytevector-copy   " 1000 (lambda () (bytevector-length (bytevector-copy bv))))
+(time-it "list fill         " 10 (lambda () (list-sum (make-list size 42))))
+(time-it "bytevector-fill!  " 1000 (lambda () (begin (bytevector-fill! bv-key 42) (bytevector-sum bv-key))))
+(time-it "list compare      " 10 (lambda () (list-equal? data data2)))
+(time-it "bytevector=?      " 1000 (lambda () (bytevector=? bv bv2)))
+(time-it "list search       " 10 (lambda () (list-index needle data-needle)))
+(time-it "bytevector-index  " 1000 (lambda () (bytevector-index bv-needle needle)))
+(time-it "list sum          " 10 (lambda () (list-sum data)))
+(time-it "bytevector-sum    " 1000 (lambda () (bytevector-sum bv)))
+(time-it "list xor          " 2 (lambda () (list-sum (list-xor data key))))
+(time-it "bytevector-xor!   " 1000 (lambda () (begin (bytevector-fill! bv-key 0) (bytevector-xor! bv-key bv) (bytevector-sum bv-key))))
+(time-it "list adler32      " 10 (lambda () (list-adler32 data)))
+(time-it "bytevector-adler32" 1000 (lambda () (bytevector-adler32 bv)))
@@ -0,0 +1,108 @@
+; Hash tables: hash-table-ref with a failure thunk and
+; hash-table-ref/default, a table growing under all the operations, and
+; string keys moved by the collector. Run with:
+; ./scheme hash-table-test.scm, every line should say ok.
+
+(define check (lambda (name got expected)
+                (begin
+                  (display (if (eqv? got expected) "ok   " "FAIL "))
+                  (display name)
+                  (display ": ")
+                  (write got)
+                  (newline))))
+
+(define h (make-hash-table))
+(hash-table-set! h 1 'one)
+(hash-table-set! h "s" '())
+
+(check "ref, key present" (hash-table-ref h 1) 'one)
+(check "ref, thunk not called" (hash-table-ref h 1 (lambda () 9)) 'one)
+(check "ref, thunk called" (hash-table-ref h 5 (lambda () 9)) 9)
+(check "ref, equal string under eqv?" (hash-table-ref h "s" (lambda () 9)) 9)
+(check "ref/default, key present" (hash-table-ref/default h 1 'none) 'one)
+(check "ref/default, key missing" (hash-table-ref/default h 5 'none) 'none)
+(check "ref/default, default is a procedure"
+       (hash-table-ref/default h 5 car) car)
+
+(define s (make-hash-table string=?))
+(hash-table-set! s "s" '())
+(check "ref, stored () with string=?" (hash-table-ref s "s" (lambda () 9)) '())
+
+; a missing key without a thunk is an error, it stops the expression
+(display "expect an error: ")
+(check "ref, no thunk" (hash-table-ref h 5) 'unreachable)
+(check "after the error" (hash-table-ref/default h 1 #f) 'one)
+
+; set!, delete!, update!/default, walk and count while the table grows.
+; Every access moves a few slots of a growing table, so most steps run
+; with entries in both vectors. Step i sets i to 2i. When i is 2 modulo 3
+; it deletes i - 1, when it is 0 modulo 3 it adds 1 to the value of i - 1.
+(define t (make-hash-table eqv?))
+(define acc (make-hash-table))
+(define add! (lambda (name n)
+               (hash-table-update!/default acc name (lambda (s) (+ s n)) 0)))
+(define walk-sum (lambda (table)
+                   (begin
+                     (hash-table-set! acc 'keys 0)
+                     (hash-table-set! acc 'values 0)
+                     (hash-table-walk table (lambda (k v)
+                                              (begin
+                                                (add! 'keys k)
+                                                (add! 'values v))))
+                     (+ (* 1000000 (hash-table-ref acc 'keys))
+                        (hash-table-ref acc 'values)))))
+(define step (lambda (i count keys values)
+               (begin
+                 (hash-table-set! t i (* 2 i))
+                 (if (= (modulo i 3) 2) (hash-table-delete! t (- i 1)) #f)
+                 (if (= (modulo i 3) 0)
+                     (if (> i 0)
+                         (hash-table-update!/default t (- i 1) (lambda (v) (+ v 1)) 0)
+                         #f)
+                     #f)
+                 (if (= (hash-table-count t) count) #f (add! 'fails 1))
+                 (if (= (walk-sum t) (+ (* 1000000 keys) values)) #f (add! 'fails 1))
+                 (if (eqv? (hash-table-ref t i) (* 2 i)) #f (add! 'fails 1)))))
+(define grow (lambda (i count keys values)
+               (if (< i 1000)
+                   (begin
+                     (define deleted (if (= (modulo i 3) 2) (- i 1) #f))
+                     (define count2 (if deleted count (+ count 1)))
+                     (define keys2 (+ keys i (if deleted (- 0 deleted) 0)))
+                     (define values2 (+ values (* 2 i)
+                                        (if deleted (* -2 deleted) 0)
+                                        (if (= (modulo i 3) 0) (if (> i 0) 1 0) 0)))
+                     (step i count2 keys2 values2)
+                     (grow (+ i 1) count2 keys2 values2))
+                   count)))
+(hash-table-set! acc 'fails 0)
+(check "count after growing" (grow 0 0 0 0) 667)
+(check "count agreed at every step" (hash-table-ref acc 'fails) 0)
+(check "deleted key" (hash-table-contains? t 997) #f)
+(check "bumped key" (hash-table-ref t 998) 1997)
+(check "untouched key" (hash-table-ref t 996) 1992)
+
+; string=? keys after the collector compacted the string heap, which moves
+; the characters of every string. The keys looked up are other strings
+; with the same characters. Bignums share the string heap, the garbage
+; ones made by churn get it compacted a few times, as (gc-info) after it
+; would show.
+(define names (make-hash-table string=?))
+(hash-table-set! names "alpha" 1)
+(hash-table-set! names "beta" 2)
+(hash-table-set! names "a longer key, past the first few characters" 3)
+(define churn (lambda (i)
+                (if (< i 20000)
+                    (begin
+                      (* 1000000000000000000000000000000000000000000000000000000000000 i)
+                      (churn (+ i 1)))
+                    #f)))
+(churn 0)
+(check "string key after compaction" (hash-table-ref names "alpha") 1)
+(check "string key after compaction, 2" (hash-table-ref names "beta") 2)
+(check "long string key after compaction"
+       (hash-table-ref names "a longer key, past the first few characters") 3)
+(hash-table-set! names "alpha" 4)
+(check "set! of a moved string key" (hash-table-count names) 3)
+(hash-table-delete! names "beta")
+(check "delete! of a moved string key" (hash-table-contains? names "beta") #f)
@@ -0,0 +1,37 @@
+; Constant folding in lambda bodies. Run with: ./scheme optimize-test.scm,
+; every check line should say ok.
+; The disassembly of each lambda starts with the code that runs while no
+; primop is redefined: a folded constant or a guard and the branch taken,
+; then return. The runtime ops after that (add, lt, num-eq, jump-if-false)
+; only run once a primop got redefined.
+
+(define check (lambda (name got expected)
+                (begin
+                  (display (if (eqv? got expected) "ok   " "FAIL "))
+                  (display name)
+                  (display ": ")
+                  (write got)
+                  (newline))))
+
+(define nested (lambda () (+ 1 (+ 2 3))))
+(define flonums (lambda () (* 2.0 (+ 1.5 (- 3.0 2.5)))))
+(define literal-test (lambda (a b) (if (< 1 2) a b)))
+(define folded-test (lambda (a b) (if (= (+ 1 1) 2) a b)))
+(define nested-test (lambda (a b) (if (< (* 2 3) (+ 1 2)) a (if (eq? 1 1) b a))))
+
+(check "nested" (nested) 6)
+(check "nested flonums" (flonums) 4.0)
+(check "if, literal test" (literal-test 'then 'else) 'then)
+(check "if, folded test" (folded-test 'then 'else) 'then)
+(check "if, nested" (nested-test 'then 'else) 'else)
+
+(disassemble nested)
+(disassemble literal-test)
+(disassemble folded-test)
+
+; redefining a primop takes the runtime path again
+(define + (lambda (a b) (- a b)))
+(check "nested after redefining +" (nested) 2)
+(check "if after redefining +" (folded-test 'then 'else) 'else)
+(define < (lambda (a b) #f))
+(check "if after redefining <" (literal-test 'then 'else) 'else)
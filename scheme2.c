@@ -1,7 +1,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <math.h>
+#include <setjmp.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include "tokenizer.h"
+#include "bytes.h"
 
 /* -------------------- end of tokenizer ------------------------------- */
 /* -----------------------memory management ---------------------------- */
@@ -9,59 +18,341 @@
 
 typedef struct scheme_ctx_s scheme_ctx_t;
 typedef struct cell_s cell_t;
+typedef struct segment_s segment_t;
+typedef struct string_block_s string_block_t;
+typedef struct string_chunk_s string_chunk_t;
+typedef struct symbol_name_s symbol_name_t;
+typedef struct symtab_entry_s symtab_entry_t;
+typedef struct tail_s tail_t;
+typedef struct primop_s primop_t;
 
+/* evaluates a node (see analyze()), tail is set in tail position */
+typedef cell_t *(*node_fn)(scheme_ctx_t *ctx, cell_t *node, tail_t *tail);
+
+/* A call to a lambda in tail position hands back the lambda and the frame
+ * for it instead of recursing, run_lambda() runs it in place of the
+ * caller. */
+struct tail_s {
+  cell_t *lambda;
+  cell_t *frame;
+};
+
+/* Types from CELL_T_FRAME on are records: a header cell followed by
+ * u.record.size pointer slots in the next cells (see mk_record()).
+ * CELL_T_NUMBER is no cell's type, primops declare with it that they take
+ * any number. */
 enum cell_type_e {
   CELL_T_EMPTY, CELL_T_PAIR, CELL_T_STRING, CELL_T_SYMBOL,
-  CELL_T_INTEGER, CELL_T_PRIMOP, CELL_T_LAMBDA, CELL_T_MACRO};
+  CELL_T_INTEGER, CELL_T_PRIMOP, CELL_T_LAMBDA, CELL_T_MACRO, CELL_T_BIGNUM,
+  CELL_T_FLONUM, CELL_T_BYTEVECTOR, CELL_T_NUMBER,
+  CELL_T_FRAME, CELL_T_PROC, CELL_T_NODE, CELL_T_CODE, CELL_T_VECTOR,
+  CELL_T_HASHTABLE};
 
 static char *cell_type_names[] = {
-  "empty", "pair", "string", "symbol", "integer", "primop", "lambda", "macro", NULL
+  "empty", "pair", "string", "symbol", "integer", "primop", "lambda", "macro",
+  "bignum", "flonum", "bytevector", "number", "frame", "proc", "node", "code",
+  "vector", "hash table", NULL
+};
+
+/* A primop gets its evaluated arguments as the vector args[0..n-1], which
+ * stays valid for the whole call (see roots_grow()). Its entry declares
+ * the arity and the types of the arguments, CELL_T_EMPTY for any type;
+ * apply_primop() checks them before the call. */
+#define PRIMOP_TYPED 2
+#define PRIMOP_VARIADIC -1
+typedef cell_t *(*primop_fn)(scheme_ctx_t *ctx, cell_t **args, int n);
+struct primop_s {
+  char *name;
+  primop_fn fn;
+  int min_args;
+  int max_args;               /* or PRIMOP_VARIADIC */
+  int types[PRIMOP_TYPED];    /* of the first arguments */
+  int rest_type;              /* of the ones after them */
 };
 
+/* A cell is just two words. Its type lives in the segment header (see
+ * cell_type()), so a pair is exactly 16 bytes. */
 struct cell_s {
-  enum cell_type_e type;
-  int flags;
-#define CELL_F_MARK 1
-#define CELL_F_USED 2
   union {
     struct {
       cell_t *car;
       cell_t *cdr;
     } pair;
     char *string;
-    char *symbol;
-    int integer;
-    cell_t *(*primop)(scheme_ctx_t *, cell_t *);
+    /* integers that do not fit a fixnum: the digits are kept in the string
+     * heap like the characters of a string, so 'digits' has to stay the
+     * first word (see string_sweep()) */
+    struct {
+      uint32_t *digits;  /* base 2^32, least significant first */
+      intptr_t size;     /* number of digits, negative for a negative number */
+    } bignum;
+    /* raw bytes, in the string heap as well */
+    struct {
+      uint8_t *bytes;
+      size_t length;
+    } bytevector;
+    /* a symbol is also the slot of the global variable it names */
+    struct {
+      char *name;
+      cell_t *value;
+    } symbol;
+    const primop_t *primop;
+    double flonum;
+    /* lambdas and macros are closures: code plus the frame they were
+     * created in */
     struct {
-      cell_t *names;
-      cell_t *body;
+      cell_t *proc;
+      cell_t *env;
     } lambda;
     struct {
-      cell_t *arg_name;
-      cell_t *body;
-    } macro;
+      size_t size;
+      union {
+        node_fn exec;  /* nodes, see analyze() */
+        int captured;  /* frames: a closure was made in it */
+        size_t length; /* vectors, see mk_vector() */
+      };
+    } record;
   } u;
+} __attribute__((aligned(16)));
+
+/* Small integers and the special values (), #t and #f are not allocated;
+ * they are encoded in the pointer itself. Cells are 16 byte aligned,
+ * so the low bits tell them apart: ...1 is a fixnum, ..10 a constant. Use
+ * cell_type() on anything that may be immediate. */
+#define is_immediate(obj) (((uintptr_t)(obj) & 3) != 0)
+#define is_fixnum(obj) (((uintptr_t)(obj) & 1) != 0)
+#define mk_fixnum(i) ((cell_t *)(((uintptr_t)(intptr_t)(i) << 1) | 1))
+#define fixnum_value(obj) ((intptr_t)(obj) >> 1)
+/* the 63 bits left after the tag: fixnums are -2^62 to 2^62-1 */
+#define FIXNUM_MAX (INTPTR_MAX >> 1)
+#define FIXNUM_MIN (INTPTR_MIN >> 1)
+#define fixnum_fits(i) ((i) >= FIXNUM_MIN && (i) <= FIXNUM_MAX)
+/* *z = x op y, nonzero if that is no fixnum */
+#define fixnum_add_overflow(x, y, z) \
+  (__builtin_add_overflow(x, y, z) || !fixnum_fits(*(z)))
+#define fixnum_sub_overflow(x, y, z) \
+  (__builtin_sub_overflow(x, y, z) || !fixnum_fits(*(z)))
+#define fixnum_mul_overflow(x, y, z) \
+  (__builtin_mul_overflow(x, y, z) || !fixnum_fits(*(z)))
+#define mk_constant(n) ((cell_t *)(((uintptr_t)(n) << 2) | 2))
+#define CONSTANT_NIL mk_constant(0)
+#define CONSTANT_FALSE mk_constant(1)
+#define CONSTANT_TRUE mk_constant(2)
+#define CONSTANT_UNBOUND mk_constant(3)  /* value of undefined globals */
+#define CONSTANT_DELETED mk_constant(4)  /* key of removed hash table entries */
+
+/* The heap is a list of segments. Each one is mapped separately, aligned to
+ * its size so the segment of a cell can be found by masking its address,
+ * and can be given back to the OS when it runs empty.
+ *
+ * The gc state of the cells lives in bitmaps in the segment header, one bit
+ * per cell: 'used' (allocated), 'old' (survived a collection), 'mark' and
+ * 'remembered' (old cell in the remembered set). The sweep works on these a
+ * word (64 cells) at a time and never touches the cells themselves. The
+ * type of each cell is kept in a byte array next to the bitmaps. */
+#define SEGMENT_SIZE (128 * 1024)
+#define SEGMENT_HEADER_SIZE 64
+#define SEGMENT_BITMAPS 4
+#define SEGMENT_CELLS \
+  ((((SEGMENT_SIZE - SEGMENT_HEADER_SIZE) * 8) \
+    / (sizeof(cell_t) * 8 + SEGMENT_BITMAPS + 8)) & ~(size_t)63)
+#define SEGMENT_WORDS (SEGMENT_CELLS / 64)
+struct segment_s {
+  segment_t *next;
+  size_t in_use;     /* exact unless 'unswept' is set */
+  size_t marked;     /* cells marked by the last full collection */
+  int unswept;       /* bitmaps still hold the result of the last marking */
+  uint64_t used[SEGMENT_WORDS];
+  uint64_t old[SEGMENT_WORDS];
+  uint64_t mark[SEGMENT_WORDS];
+  uint64_t remembered[SEGMENT_WORDS];
+  uint8_t types[SEGMENT_CELLS];
+  cell_t cells[];
+};
+_Static_assert(sizeof(segment_t)
+    <= SEGMENT_HEADER_SIZE + (SEGMENT_BITMAPS + 8) * SEGMENT_CELLS / 8
+    && sizeof(segment_t) + SEGMENT_CELLS * sizeof(cell_t) <= SEGMENT_SIZE,
+    "segment layout does not fit");
+#define segment_end(seg) ((seg)->cells + SEGMENT_CELLS)
+#define segment_of(cell) \
+  ((segment_t *)((uintptr_t)(cell) & ~(uintptr_t)(SEGMENT_SIZE - 1)))
+
+#define bit_word(seg, cell) (((cell) - (seg)->cells) / 64)
+#define bit_mask(seg, cell) ((uint64_t)1 << (((cell) - (seg)->cells) % 64))
+#define get_bit(map, seg, cell) \
+  ((seg)->map[bit_word(seg, cell)] & bit_mask(seg, cell))
+#define set_bit(map, seg, cell) \
+  ((seg)->map[bit_word(seg, cell)] |= bit_mask(seg, cell))
+#define clear_bit(map, seg, cell) \
+  ((seg)->map[bit_word(seg, cell)] &= ~bit_mask(seg, cell))
+
+/* type of a cell known to be on the heap */
+#define heap_cell_type(cell) \
+  ((enum cell_type_e)segment_of(cell)->types[(cell) - segment_of(cell)->cells])
+#define set_cell_type(cell, type) \
+  (segment_of(cell)->types[(cell) - segment_of(cell)->cells] = (type))
+
+#define record_slots(obj) ((cell_t **)((obj) + 1))
+#define record_cells(size) (1 + ((size) + 1) / 2)
+
+static inline enum cell_type_e cell_type(cell_t *obj)
+{
+  if (is_immediate(obj)) {
+    return is_fixnum(obj) ? CELL_T_INTEGER : CELL_T_EMPTY;
+  }
+  return heap_cell_type(obj);
+}
+
+/* String payloads live in a heap of their own: chunks filled with length
+ * prefixed blocks. Each block points back to the cell owning it, so blocks
+ * can be dropped when that cell died and moved when the string heap gets
+ * compacted. Never keep a pointer into a string across an allocation. */
+#define STRING_CHUNK_SIZE (64 * 1024)
+struct string_block_s {
+  cell_t *owner;  /* NULL once the owner is gone */
+  size_t len;
+  char data[];
+};
+#define string_block(str) \
+  ((string_block_t *)((str) - offsetof(string_block_t, data)))
+#define string_block_size(len) \
+  ((sizeof(string_block_t) + (len) + 1 + 15) & ~(size_t)15)
+struct string_chunk_s {
+  string_chunk_t *next;
+  size_t size;
+  size_t pos;
+  size_t live;
+  char *data; /* 16 byte aligned start of the blocks */
 };
 
-#define MAX_SINK_SIZE 1024
+/* Symbol names are never freed, they go into a simple bump arena together
+ * with their length and hash. Symbols are found through an open addressing
+ * hash table; ctx->syms still lists them all and keeps them alive. */
+#define SYMBOL_ARENA_SIZE (16 * 1024)
+#define INITIAL_SYMTAB_SIZE 256
+struct symbol_name_s {
+  uint32_t hash;
+  uint32_t len;
+  char name[];
+};
+#define symbol_name(str) \
+  ((symbol_name_t *)((str) - offsetof(symbol_name_t, name)))
+struct symtab_entry_s {
+  uint32_t hash;
+  cell_t *symbol; /* NULL if the slot is free */
+};
+
+#define INITIAL_ROOTS_SIZE 1024
+#define MARK_STACK_SIZE 1024
+#define DEFAULT_HEAP_SIZE (1024 * 16 * sizeof(cell_t))
+#define DEFAULT_LIVE_RATIO 50
+
+/* Incremental mode: a full collection is spread over many small steps, each
+ * scanning gc_quantum cells. A step happens every gc_quantum / GC_MARK_RATIO
+ * allocated cells, so marking outpaces the program. Sweeping a segment
+ * costs about as much as scanning GC_SWEEP_COST cells. */
+#define DEFAULT_GC_QUANTUM 1024
+#define GC_MARK_RATIO 2
+#define GC_SWEEP_COST (SEGMENT_WORDS / 4)
+enum gc_phase_e { GC_IDLE, GC_SWEEPING, GC_MARKING };
+
+/* lambda bodies run as bytecode (see vm_run()) or by evaluating their
+ * nodes */
+enum engine_e { ENGINE_VM, ENGINE_AST };
+
+/* Calls between compiled lambdas keep their state on the root stack, which
+ * grows on the heap; the number of calls in progress is limited to
+ * max_depth. Everything that still recurses in C (the tree walker, calls
+ * from primops, macros, the printer) stops before using more than
+ * C_STACK_SHARE percent of the C stack. */
+#define DEFAULT_MAX_DEPTH 1000000
+#define C_STACK_SHARE 75
+#define DEFAULT_C_STACK (8 * 1024 * 1024)
+
+/* Pause times are kept in a log-linear histogram: 16 buckets per power of
+ * two, so a percentile is exact to within 1/16. */
+#define PAUSE_BUCKETS (61 * 16)
 struct scheme_ctx_s {
-  cell_t *sink[MAX_SINK_SIZE];
-  int  sink_pos;
+  /* shadow stack of cells that must survive a collection */
+  cell_t **roots;
+  size_t roots_pos;
+  size_t roots_size;
+  cell_t **roots_retired[64];  /* it doubles, this is plenty */
+  int roots_retired_count;
   size_t memory_size;
-  cell_t NIL_VALUE;
-  cell_t TRUE_VALUE;
-  cell_t FALSE_VALUE;
   cell_t *NIL;
   cell_t *FALSE;
   cell_t *TRUE;
   cell_t *syms;
-  cell_t *env;
+  cell_t *frame;  /* local variables of the running lambda */
   cell_t *code;
-  cell_t *result;
-  cell_t *args;
-  cell_t *memory;
-  int memory_in_use;
-  int memory_pos;
+  segment_t *segments;
+  int segment_count;
+  size_t memory_in_use;
+  /* heap sizing policy, all sizes are in cells */
+  size_t memory_min;
+  size_t memory_max;
+  int live_ratio; /* targeted percentage of live cells after gc_collect */
+  size_t gc_threshold; /* cells in use that trigger the next gc_collect */
+  /* nursery: the segment young cells are bump-allocated in */
+  cell_t *alloc_ptr;
+  cell_t *alloc_limit;
+  segment_t *nursery;
+  size_t nursery_in_use;
+  /* old cells which got a pointer to a young cell stored into them */
+  cell_t **remembered;
+  int remembered_pos;
+  int remembered_size;
+  /* string heap */
+  string_chunk_t *string_chunks; /* the last one is allocated from */
+  string_chunk_t *string_chunk;
+  size_t string_heap_size;
+  size_t string_heap_live;     /* as of the last full collection */
+  size_t string_allocated;     /* since the last full collection */
+  unsigned long string_compactions;
+  char *symbol_arena;
+  size_t symbol_arena_left;
+  symtab_entry_t *symtab;
+  size_t symtab_size;  /* a power of two */
+  size_t symtab_count;
+  /* full collection wanted at the next opportunity */
+  int gc_requested;
+  /* incremental collection */
+  int gc_incremental;
+  enum engine_e engine;  /* what runs the body of a lambda */
+  int print_optimized;   /* print lambda bodies after optimize() */
+  int builtin_epoch;     /* counts redefinitions of primops */
+  int cells_moved;       /* counts collections that moved cells */
+  enum gc_phase_e gc_phase;
+  size_t gc_quantum;
+  segment_t *gc_sweep_cursor;
+  cell_t **gc_snapshot;          /* roots at the start of marking */
+  size_t gc_snapshot_pos;
+  size_t gc_snapshot_size;
+  /* marking */
+  cell_t **mark_stack;
+  int mark_stack_pos;
+  int mark_overflow;
+  /* allocation statistics */
+  unsigned long cells_allocated;
+  unsigned long cells_freed;
+  unsigned long cells_promoted;
+  unsigned long gc_runs;
+  unsigned long gc_minor_runs;
+  unsigned long gc_steps;
+  /* gc pause times in nanoseconds */
+  unsigned long pause_count;
+  uint64_t pause_max;
+  unsigned long pause_histogram[PAUSE_BUCKETS];
+  /* calls in progress */
+  size_t depth;
+  size_t depth_high;  /* the most there were */
+  size_t max_depth;
+  char *c_stack_base;
+  size_t c_stack_limit;
+  /* toplevel error recovery, see scheme_error() */
+  jmp_buf error_jmp;
+  int error_jmp_set;
   tokenizer_ctx_t tokenizer_ctx;
   cell_t *PARENTHESIS_OPEN;
   cell_t *PARENTHESIS_CLOSE;
@@ -79,995 +370,5434 @@ struct scheme_ctx_s {
   cell_t *SYMBOL_UNQUOTE_ALIAS;
   cell_t *SYMBOL_UNQUOTE_SPLICE;
   cell_t *SYMBOL_UNQUOTE_SPLICE_ALIAS;
+  cell_t *VECTOR_OPEN;
+  cell_t *BYTEVECTOR_PREFIX;
 };
 
-static cell_t *add_to_sink(scheme_ctx_t *ctx, cell_t *);
-static void gc_collect(scheme_ctx_t *ctx, cell_t *tmp_a, cell_t *tmp_b);
+static inline cell_t *push_root(scheme_ctx_t *ctx, cell_t *);
+static void gc_collect(scheme_ctx_t *ctx);
+static void gc_minor(scheme_ctx_t *ctx);
+static void gc_start_cycle(scheme_ctx_t *ctx);
+static void gc_step(scheme_ctx_t *ctx);
+static void check_c_stack(scheme_ctx_t *ctx);
 void print_obj(scheme_ctx_t *ctx, cell_t *obj);
 
-static cell_t *raw_get_cell(scheme_ctx_t *ctx, cell_t *tmp_a, cell_t *tmp_b)
+static int is_young(cell_t *cell)
+{
+  segment_t *seg = segment_of(cell);
+  return !get_bit(old, seg, cell);
+}
+
+/* Abort evaluation of the current toplevel form. */
+static void scheme_error(scheme_ctx_t *ctx, char *msg)
 {
-  if (ctx->memory_size - ctx->memory_in_use < 1) {
-    gc_collect(ctx, tmp_a, tmp_b);
+  printf("ERROR: %s\n", msg);
+  if (!ctx->error_jmp_set) {
+    exit(1);
   }
-  int i = ctx->memory_pos;
-  size_t memory_size = ctx->memory_size;
-  cell_t *memory = ctx->memory;
-  for (int cnt = 0; cnt < memory_size; ++cnt) {
-    cell_t *current_cell = &memory[i];
-    if (!(current_cell->flags & CELL_F_USED)) {
-      current_cell->flags |= CELL_F_USED;
-      ctx->memory_in_use += 1;
-      ctx->memory_pos = (i + 1) % memory_size;
-      return current_cell;
-    }
-    i = (i + 1) % memory_size;
+  longjmp(ctx->error_jmp, 1);
+}
+
+static segment_t *segment_new(scheme_ctx_t *ctx)
+{
+  /* map twice the size and cut away what is not aligned */
+  char *map = mmap(NULL, SEGMENT_SIZE * 2, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED) {
+    return NULL;
   }
-  printf("out of memory\n");
-  exit(1);
-  return NULL;
+  char *start = (char *)(((uintptr_t)map + SEGMENT_SIZE - 1)
+      & ~(uintptr_t)(SEGMENT_SIZE - 1));
+  if (start > map) {
+    munmap(map, start - map);
+  }
+  munmap(start + SEGMENT_SIZE, map + SEGMENT_SIZE - start);
+  segment_t *seg = (segment_t *)start;
+  /* fresh mappings are zeroed: all cells are free */
+  seg->next = ctx->segments;
+  ctx->segments = seg;
+  ctx->segment_count += 1;
+  ctx->memory_size += SEGMENT_CELLS;
+  return seg;
 }
 
-static cell_t *get_cell(scheme_ctx_t *ctx)
+/* The maximum heap size covers the segments and the string heap, counted
+ * here in cells. */
+static int heap_over_limit(scheme_ctx_t *ctx, size_t cells, size_t string_bytes)
 {
-  cell_t *ret = raw_get_cell(ctx, ctx->NIL, ctx->NIL);
-  return add_to_sink(ctx, ret);
+  return cells + (string_bytes + sizeof(cell_t) - 1) / sizeof(cell_t)
+    > ctx->memory_max;
 }
 
-static cell_t *add_to_sink(scheme_ctx_t *ctx, cell_t *cell)
+static int heap_grow(scheme_ctx_t *ctx, size_t memory_size)
 {
-  if (ctx->sink_pos >= MAX_SINK_SIZE) {
-    printf("out of sink space\n");
-    return cell;
+  while (ctx->memory_size < memory_size) {
+    if (heap_over_limit(ctx, ctx->memory_size + SEGMENT_CELLS,
+          ctx->string_heap_size)
+        || !segment_new(ctx)) {
+      return -1;
+    }
   }
-  ctx->sink[ctx->sink_pos ++] = cell;
-  return cell;
+  return 0;
 }
 
-cell_t *cons(scheme_ctx_t *ctx, cell_t *car, cell_t *cdr)
+/* give empty segments back to the OS until the heap is down to memory_size */
+static void heap_shrink(scheme_ctx_t *ctx, size_t memory_size)
 {
-  cell_t *ret = get_cell(ctx);
-  ret->type = CELL_T_PAIR;
-  ret->u.pair.car = car;
-  ret->u.pair.cdr = cdr;
-  return ret;
+  segment_t **link = &ctx->segments;
+  while (*link && ctx->memory_size - SEGMENT_CELLS >= memory_size) {
+    segment_t *seg = *link;
+    if (seg->in_use || seg == ctx->nursery) {
+      link = &seg->next;
+      continue;
+    }
+    *link = seg->next;
+    ctx->segment_count -= 1;
+    ctx->memory_size -= SEGMENT_CELLS;
+    munmap(seg, SEGMENT_SIZE);
+  }
 }
 
-#define mark_cell(cell) (cell)->flags |= CELL_F_MARK;
-#define unmark_cell(cell) (cell)->flags &= ~CELL_F_MARK;
-
-void mark_cells(cell_t *cell)
+/* Resize the heap after a full collection so that the live cells make up
+ * about live_ratio percent of it, and pick the point at which the next full
+ * collection happens. */
+static void heap_resize(scheme_ctx_t *ctx)
 {
-  if (cell->flags & CELL_F_MARK) {
-    /* cell ist already marked */
-    return;
+  size_t live = ctx->memory_in_use;
+  size_t target = live / ctx->live_ratio * 100 + SEGMENT_CELLS;
+  if (target < ctx->memory_min) {
+    target = ctx->memory_min;
   }
-  /* mark this cell */
-  mark_cell(cell);
-  switch(cell->type) {
-    case CELL_T_PAIR:
-      mark_cells(cell->u.pair.car);
-      mark_cells(cell->u.pair.cdr);
-      break;
-    case CELL_T_LAMBDA:
-      mark_cells(cell->u.lambda.names);
-      mark_cells(cell->u.lambda.body);
-      break;
-    case CELL_T_MACRO:
-      mark_cells(cell->u.macro.arg_name);
-      mark_cells(cell->u.macro.body);
-      break;
-    default:
-      break;
+  if (target > ctx->memory_max) {
+    target = ctx->memory_max;
+  }
+  /* new segments are mapped by heap_make_room() when they are needed, that
+   * keeps mmap() out of the gc pause */
+  heap_shrink(ctx, target);
+  size_t size = target > ctx->memory_size ? target : ctx->memory_size;
+  size_t free = size - live;
+  if (free < SEGMENT_CELLS) {
+    /* collecting again would hardly free anything */
+    ctx->gc_threshold = size;
+  } else if (ctx->gc_incremental) {
+    /* leave room for what gets allocated while the cycle runs */
+    ctx->gc_threshold = live + free / 2;
+  } else {
+    ctx->gc_threshold = size - SEGMENT_CELLS;
   }
 }
 
-void unmark_cells(cell_t *cell)
+/* Make sure there is at least one free cell somewhere in the heap. */
+static void heap_make_room(scheme_ctx_t *ctx)
 {
-  if (!(cell->flags & CELL_F_MARK)) {
-     return;
+  if (ctx->memory_in_use < ctx->memory_size) {
+    return;
   }
-  unmark_cell(cell);
-  switch(cell->type) {
-    case CELL_T_PAIR:
-      unmark_cells(cell->u.pair.car);
-      unmark_cells(cell->u.pair.cdr);
-      break;
-    case CELL_T_LAMBDA:
-      unmark_cells(cell->u.lambda.names);
-      unmark_cells(cell->u.lambda.body);
-      break;
-    case CELL_T_MACRO:
-      unmark_cells(cell->u.macro.arg_name);
-      unmark_cells(cell->u.macro.body);
-      break;
-    default:
-      break;
+  if (!heap_grow(ctx, ctx->memory_size + 1)) {
+    return;
+  }
+  gc_collect(ctx);
+  if (ctx->memory_size - ctx->memory_in_use < SEGMENT_CELLS / 2) {
+    /* almost everything is alive and the heap may not grow: fail instead of
+     * collecting over and over again */
+    scheme_error(ctx, "out of memory");
   }
 }
 
-void print_obj(scheme_ctx_t *ctx, cell_t *obj);
-static void gc_collect(scheme_ctx_t *ctx, cell_t *tmp_a, cell_t *tmp_b)
-{
-  cell_t **sink = ctx->sink;
-  cell_t *memory = ctx->memory;
-  size_t sink_pos = ctx->sink_pos;
-  size_t memory_size = ctx->memory_size;
-  size_t memory_in_use = ctx->memory_in_use;
-
-  for(int i = 0; i < ctx->sink_pos; ++i) {
-    mark_cells(ctx->sink[i]);
-  }
-  mark_cells(ctx->syms);
-  mark_cells(ctx->env);
-  mark_cells(ctx->args);
-  mark_cells(ctx->result);
-  mark_cells(tmp_a);
-  mark_cells(tmp_b);
-
-  for (int i = 0; i < memory_size; ++i) {
-    cell_t *current_cell = &memory[i];
-    if ((current_cell->flags & (CELL_F_USED | CELL_F_MARK)) == CELL_F_USED) {
-      current_cell->flags = 0;
-#if 0
-      /* this is useful for debugging garbage collector */
-      memset(current_cell, 0, sizeof(*current_cell));
-#endif
-      memory_in_use -= 1;
+/* Lazy sweep: a full collection only marks. Each segment is swept when the
+ * allocator gets to it (or before the next full collection), which frees
+ * the unmarked cells, makes the marked ones old and clears the marks. */
+static void gc_sweep_segment(scheme_ctx_t *ctx, segment_t *seg)
+{
+  for (int w = 0; w < SEGMENT_WORDS; ++w) {
+    uint64_t dead = seg->used[w] & ~seg->mark[w];
+    if (dead) {
+      ctx->cells_freed += __builtin_popcountll(dead);
+      seg->used[w] &= ~dead;
     }
+    seg->old[w] = seg->used[w];
+    seg->mark[w] = 0;
   }
+  seg->in_use = seg->marked;
+  seg->unswept = 0;
+}
 
-  for (int i = 0; i < sink_pos; ++i) {
-    unmark_cells(sink[i]);
+static void gc_sweep_all(scheme_ctx_t *ctx)
+{
+  for (segment_t *seg = ctx->segments; seg; seg = seg->next) {
+    if (seg->unswept) {
+      gc_sweep_segment(ctx, seg);
+    }
   }
-  unmark_cells(ctx->syms);
-  unmark_cells(ctx->env);
-  unmark_cells(ctx->args);
-  unmark_cells(ctx->result);
-  unmark_cells(tmp_a);
-  unmark_cells(tmp_b);
-
-  ctx->memory_in_use = memory_in_use;
 }
 
-void gc_info(scheme_ctx_t *ctx)
+/* index of the first bit >= i in map which is 'value', or SEGMENT_CELLS */
+static size_t bitmap_find(uint64_t *map, size_t i, int value)
 {
-  int memory_size = ctx->memory_size;
-  int ret = memory_size;
-  cell_t *memory = ctx->memory;
-  for (int i = 0; i < memory_size; ++i) {
-    if (memory[i].flags & CELL_F_USED) {
-      -- ret;
+  while (i < SEGMENT_CELLS) {
+    uint64_t word = value ? map[i / 64] : ~map[i / 64];
+    word &= ~(uint64_t)0 << (i % 64);
+    if (word) {
+      return (i & ~(size_t)63) + __builtin_ctzll(word);
     }
+    i = (i & ~(size_t)63) + 64;
   }
-  printf("%d cells are free\n", ret);
+  return SEGMENT_CELLS;
 }
 
-#define _car(obj) ((obj)->u.pair.car)
-#define _cdr(obj) ((obj)->u.pair.cdr)
-#define is_integer(obj) ((obj)->type == CELL_T_INTEGER)
-#define is_null(ctx, obj) ((ctx)->NIL == obj)
-#define is_sym(obj) ((obj)->type == CELL_T_SYMBOL)
-#define is_pair(obj) ((obj)->type == CELL_T_PAIR)
-#define is_true(ctx, obj) ((obj) != (ctx)->FALSE)
-#define is_false(ctx, obj) ((obj) == (ctx)->FALSE)
-#define is_primop(obj) ((obj)->type == CELL_T_PRIMOP)
-#define is_lambda(obj) ((obj)->type == CELL_T_LAMBDA)
-#define is_macro(obj) ((obj)->type == CELL_T_MACRO)
-/* symbols */
+/* mark cells [start, end) of seg as used (or as free) */
+static void bitmap_set_range(uint64_t *map, size_t start, size_t end,
+    int value)
+{
+  while (start < end) {
+    size_t bits = 64 - start % 64;
+    if (bits > end - start) {
+      bits = end - start;
+    }
+    uint64_t mask = (bits == 64 ? ~(uint64_t)0 : (((uint64_t)1 << bits) - 1))
+      << (start % 64);
+    if (value) {
+      map[start / 64] |= mask;
+    } else {
+      map[start / 64] &= ~mask;
+    }
+    start += bits;
+  }
+}
 
-static int get_args(cell_t *args, int nr, int types[], cell_t *ret[]);
+/* set cells [start, end) of map, returns how many were not set before */
+static size_t bitmap_mark_range(uint64_t *map, size_t start, size_t end)
+{
+  size_t count = 0;
+  while (start < end) {
+    size_t bits = 64 - start % 64;
+    if (bits > end - start) {
+      bits = end - start;
+    }
+    uint64_t mask = (bits == 64 ? ~(uint64_t)0 : (((uint64_t)1 << bits) - 1))
+      << (start % 64);
+    count += __builtin_popcountll(mask & ~map[start / 64]);
+    map[start / 64] |= mask;
+    start += bits;
+  }
+  return count;
+}
 
-cell_t *mk_symbol(scheme_ctx_t *ctx, char *str)
+/* Give back the part of the current allocation run that was not used. */
+static void nursery_release_run(scheme_ctx_t *ctx)
 {
-  for (cell_t *tmp = ctx->syms; !is_null(ctx, tmp); tmp = _cdr(tmp)) {
-    if (!strcmp(str, _car(tmp)->u.symbol)) {
-      return _car(tmp);
+  size_t left = ctx->alloc_limit - ctx->alloc_ptr;
+  if (left) {
+    segment_t *seg = ctx->nursery;
+    bitmap_set_range(seg->used, ctx->alloc_ptr - seg->cells,
+        ctx->alloc_limit - seg->cells, 0);
+    if (ctx->gc_phase == GC_MARKING) {
+      bitmap_set_range(seg->mark, ctx->alloc_ptr - seg->cells,
+          ctx->alloc_limit - seg->cells, 0);
+      seg->marked -= left;
     }
+    ctx->memory_in_use -= left;
+    ctx->nursery_in_use -= left;
+    ctx->cells_allocated -= left;
+    ctx->alloc_limit = ctx->alloc_ptr;
   }
-  /* add new entry */
-  cell_t *ret = get_cell(ctx);
-  ret->type = CELL_T_SYMBOL;
-  ret->u.symbol = strdup(str);
-  ctx->syms = cons(ctx, ret, ctx->syms);
-  return ret;
 }
 
-cell_t *mk_primop(scheme_ctx_t *ctx, cell_t *(*fn)(scheme_ctx_t *, cell_t *))
+/* Find the next run of free cells inside the nursery segment and make it the
+ * bump-allocation region; the whole run is flagged used up front. When the
+ * segment is used up its young cells are collected (minor gc) and
+ * allocation moves on to the next segment. A full collection happens when
+ * the old generation grows past gc_threshold.
+ *
+ * While an incremental collection is running, every run does one step of
+ * it. Runs are then kept short and allocated black (marked), and there are
+ * no minor collections: the marking would get in their way.
+ *
+ * The run found has at least 'min' cells. */
+static void nursery_next_run(scheme_ctx_t *ctx, size_t min)
 {
-  cell_t *ret = get_cell(ctx);
-  ret->type = CELL_T_PRIMOP;
-  ret->u.primop = fn;
-  return ret;
+  int misses = 0;
+  int collected = 0;
+  if (ctx->gc_phase != GC_IDLE) {
+    gc_step(ctx);
+  }
+  for (;;) {
+    segment_t *seg = ctx->nursery;
+    if (seg->unswept) {
+      gc_sweep_segment(ctx, seg);
+    }
+    size_t start = bitmap_find(seg->used, ctx->alloc_limit - seg->cells, 0);
+    size_t end = start;
+    while (start < SEGMENT_CELLS) {
+      end = bitmap_find(seg->used, start, 1);
+      if (end - start >= min) {
+        break;
+      }
+      start = bitmap_find(seg->used, end, 0);
+    }
+    if (start < SEGMENT_CELLS) {
+      size_t cap = ctx->gc_quantum / GC_MARK_RATIO;
+      if (ctx->gc_phase != GC_IDLE && end - start > cap) {
+        end = start + (cap > min ? cap : min);
+      }
+      bitmap_set_range(seg->used, start, end, 1);
+      if (ctx->gc_phase == GC_MARKING) {
+        bitmap_set_range(seg->mark, start, end, 1);
+        seg->marked += end - start;
+      }
+      ctx->alloc_ptr = seg->cells + start;
+      ctx->alloc_limit = seg->cells + end;
+      ctx->memory_in_use += end - start;
+      ctx->nursery_in_use += end - start;
+      ctx->cells_allocated += end - start;
+      return;
+    }
+    /* segment exhausted */
+    if (ctx->gc_phase == GC_MARKING) {
+      /* all young cells survive this cycle anyway */
+      for (int w = 0; w < SEGMENT_WORDS; ++w) {
+        seg->old[w] = seg->used[w];
+      }
+      ctx->cells_promoted += ctx->nursery_in_use;
+      ctx->nursery_in_use = 0;
+    } else if (ctx->nursery_in_use) {
+      size_t in_use = ctx->memory_in_use;
+      gc_minor(ctx);
+      if (ctx->memory_in_use > ctx->gc_threshold || ctx->gc_requested) {
+        if (!ctx->gc_incremental) {
+          gc_collect(ctx);
+        } else if (ctx->gc_phase == GC_IDLE) {
+          gc_start_cycle(ctx);
+        }
+      } else if (in_use - ctx->memory_in_use >= SEGMENT_CELLS / 2) {
+        /* most of the segment died, keep on using it while it is hot */
+        ctx->alloc_ptr = ctx->alloc_limit = ctx->nursery->cells;
+        continue;
+      }
+    }
+    heap_make_room(ctx);
+    if (++ misses > ctx->segment_count) {
+      /* no segment has a free run that is long enough */
+      if (heap_grow(ctx, ctx->memory_size + SEGMENT_CELLS)) {
+        /* at the size limit, collect everything once before giving up */
+        if (!collected) {
+          gc_collect(ctx);
+          collected = 1;
+          misses = 0;
+        } else if (misses > 2 * ctx->segment_count + 2) {
+          scheme_error(ctx, "out of memory");
+        }
+      }
+    }
+    ctx->nursery = ctx->nursery->next ? ctx->nursery->next : ctx->segments;
+    ctx->alloc_ptr = ctx->alloc_limit = ctx->nursery->cells;
+  }
 }
 
-cell_t *mk_string(scheme_ctx_t *ctx, char* str)
+static cell_t *raw_get_cell(scheme_ctx_t *ctx)
 {
-  cell_t *ret = get_cell(ctx);
-  ret->type = CELL_T_STRING;
-  ret->u.string = strdup(str);
-  return ret;
+  if (ctx->alloc_ptr >= ctx->alloc_limit) {
+    nursery_next_run(ctx, 1);
+  }
+  return ctx->alloc_ptr ++;
 }
 
-cell_t *mk_integer(scheme_ctx_t *ctx, int integer)
+static cell_t *get_cell(scheme_ctx_t *ctx)
 {
-  cell_t *ret = get_cell(ctx);
-  ret->type = CELL_T_INTEGER;
-  ret->u.integer = integer;
-  return ret;
+  cell_t *ret = raw_get_cell(ctx);
+  return push_root(ctx, ret);
 }
 
-cell_t *mk_lambda(scheme_ctx_t *ctx, cell_t *lambda)
+/* n consecutive cells */
+static cell_t *get_cells(scheme_ctx_t *ctx, size_t n)
 {
-  cell_t *arg[2];
-  int types[2] = {CELL_T_EMPTY, CELL_T_EMPTY};
-  if (get_args(lambda, 2, types, arg)) {
-    return ctx->NIL;
+  if (n > SEGMENT_CELLS / 2) {
+    scheme_error(ctx, "object too large");
   }
-  if (!is_pair(arg[0]) && !is_sym(arg[0]) && !is_null(ctx, arg[0])) {
-    printf("lambda: parameter 1 must be a pair or sym\n");
-    return ctx->NIL;
+  if ((size_t)(ctx->alloc_limit - ctx->alloc_ptr) < n) {
+    /* the rest of this run is too short, skip it */
+    cell_t *end = ctx->alloc_limit;
+    nursery_release_run(ctx);
+    ctx->alloc_ptr = ctx->alloc_limit = end;
+    nursery_next_run(ctx, n);
   }
-  cell_t *ret = get_cell(ctx);
-  ret->type = CELL_T_LAMBDA;
-  ret->u.lambda.names = _car(lambda); /* XXX arg 1 */
-  ret->u.lambda.body = _car(_cdr(lambda)); /* XXX arg 2 */
-  return ret;
+  cell_t *ret = ctx->alloc_ptr;
+  ctx->alloc_ptr += n;
+  return push_root(ctx, ret);
 }
 
-cell_t *mk_macro(scheme_ctx_t *ctx, cell_t *arg, cell_t *body)
+/* The arguments of a primop are read from the root stack while it runs,
+ * so the stack is not moved with realloc(): the old array is kept and
+ * freed when the toplevel form is done (see roots_release()). */
+static void roots_grow(scheme_ctx_t *ctx)
 {
-      cell_t *ret = get_cell(ctx);
-      ret->type = CELL_T_MACRO;
-      ret->u.macro.arg_name = arg;
-      ret->u.macro.body = body;
-      return ret;
+  size_t roots_size = ctx->roots_size ? ctx->roots_size * 2 : INITIAL_ROOTS_SIZE;
+  cell_t **roots = malloc(sizeof(cell_t *) * roots_size);
+  if (!roots) {
+    scheme_error(ctx, "out of memory");
+  }
+  if (ctx->roots) {
+    memcpy(roots, ctx->roots, sizeof(cell_t *) * ctx->roots_pos);
+    ctx->roots_retired[ctx->roots_retired_count++] = ctx->roots;
+  }
+  ctx->roots = roots;
+  ctx->roots_size = roots_size;
 }
 
+static void roots_release(scheme_ctx_t *ctx)
+{
+  while (ctx->roots_retired_count) {
+    free(ctx->roots_retired[--ctx->roots_retired_count]);
+  }
+}
 
-/* --- obj --- */
-
-cell_t *mk_object_from_token(scheme_ctx_t *ctx, char *token)
+/* Every new cell and every eval result is pushed here. Code that creates
+ * temporaries remembers ctx->roots_pos and resets it when the temporaries
+ * are no longer needed (see eval_node). */
+static inline cell_t *push_root(scheme_ctx_t *ctx, cell_t *cell)
 {
-  cell_t *ret = ctx->NIL;
-  char *c;
-  switch(*token) {
-    case '"':
-      if ((c = strchr(token+1, '"'))) {
-        *c = '\0';
-      }
-      ret = mk_string(ctx, token+1);
-      break;
-    default:
-      if (strlen(token) == strspn(token, "-0123456789")) {
-        char *rest = NULL;
-        int v = strtol(token, &rest, 10);
-        if (*rest == '\0') {
-          ret = mk_integer(ctx, v);
-        } else {
-          ret = mk_symbol(ctx, token);
-        }
-      } else {
-        ret = mk_symbol(ctx, token);
-      }
-      break;
+  if (ctx->roots_pos >= ctx->roots_size) {
+    roots_grow(ctx);
   }
-  return ret;
+  ctx->roots[ctx->roots_pos ++] = cell;
+  return cell;
 }
 
-cell_t *get_object(scheme_ctx_t *ctx);
-cell_t *get_obj_list(scheme_ctx_t *ctx)
+static void gc_mark_push(scheme_ctx_t *ctx, cell_t *cell);
+static int gc_needs_mark(scheme_ctx_t *ctx, cell_t *cell, int young_only);
+
+/* Has to be called before a pointer to 'value' is stored into the already
+ * existing cell 'obj', overwriting 'old'. Old cells pointing to young ones
+ * are recorded so the minor gc can use them as roots. While incremental
+ * marking runs, the overwritten pointer is marked: everything reachable
+ * when marking started survives (snapshot at the beginning). */
+static void gc_write_barrier(scheme_ctx_t *ctx, cell_t *obj, cell_t *old,
+    cell_t *value)
 {
-  cell_t *obj = get_object(ctx);
-  if (!obj) {
-    /* EOF reached */
-    printf("missing ')' at end of input\n");
-    exit(1);
+  if (ctx->gc_phase == GC_MARKING && gc_needs_mark(ctx, old, 0)) {
+    gc_mark_push(ctx, old);
   }
-  if (obj == ctx->PARENTHESIS_CLOSE) {
-    return ctx->NIL;
+  if (is_immediate(value) || is_young(obj) || !is_young(value)
+      || get_bit(remembered, segment_of(obj), obj)) {
+    return;
   }
-  if (obj == ctx->SYMBOL_DOT) {
-    cell_t *ret = get_object(ctx);
-    if (ctx->PARENTHESIS_CLOSE == ret) {
-      /* error */
-      printf("unexpected ')'\n");
-      return ctx->NIL;
-    } else if (ctx->PARENTHESIS_CLOSE != get_object(ctx)) {
-      printf("expect ')'!\n");
-      return ctx->NIL;
-    }
-    return ret;
+  if (ctx->remembered_pos >= ctx->remembered_size) {
+    ctx->remembered_size = ctx->remembered_size ? ctx->remembered_size * 2 : 64;
+    ctx->remembered = realloc(ctx->remembered,
+        sizeof(cell_t *) * ctx->remembered_size);
   }
-  return cons(ctx, obj, get_obj_list(ctx));
+  set_bit(remembered, segment_of(obj), obj);
+  ctx->remembered[ctx->remembered_pos ++] = obj;
 }
 
-cell_t *get_object(scheme_ctx_t *ctx)
+static void gc_forget_remembered(scheme_ctx_t *ctx)
 {
-  char *value = tokenizer_get_token(&ctx->tokenizer_ctx);
-  if (!value) {
-    return NULL; /* eof */
+  for (int i = 0; i < ctx->remembered_pos; ++i) {
+    cell_t *obj = ctx->remembered[i];
+    clear_bit(remembered, segment_of(obj), obj);
   }
-  cell_t *obj = mk_object_from_token(ctx, value);
-  if (obj == ctx->SYMBOL_QUOTE_ALIAS) {
-    return cons(ctx, ctx->SYMBOL_QUOTE, cons(ctx, get_object(ctx), ctx->NIL));
-  } else if (obj == ctx->SYMBOL_QUASIQUOTE_ALIAS) {
-    return cons(ctx, ctx->SYMBOL_QUASIQUOTE, get_object(ctx));
-  } else if (obj == ctx->SYMBOL_UNQUOTE_ALIAS) {
-    return cons(ctx, ctx->SYMBOL_UNQUOTE, cons(ctx, get_object(ctx), ctx->NIL));
-  } else if (obj == ctx->PARENTHESIS_OPEN) {
-    return get_obj_list(ctx);
-  } else if (obj == ctx->SYMBOL_UNQUOTE_SPLICE_ALIAS) {
-    return cons(ctx, ctx->SYMBOL_UNQUOTE_SPLICE, cons(ctx, get_object(ctx), ctx->NIL));
-  }
-  return obj;
+  ctx->remembered_pos = 0;
 }
 
-/*------------------------ print -------------------- */
+cell_t *cons(scheme_ctx_t *ctx, cell_t *car, cell_t *cdr)
+{
+  cell_t *ret = get_cell(ctx);
+  set_cell_type(ret, CELL_T_PAIR);
+  ret->u.pair.car = car;
+  ret->u.pair.cdr = cdr;
+  return ret;
+}
 
-void print_obj(scheme_ctx_t *ctx, cell_t *obj);
-void print_pair(scheme_ctx_t *ctx, cell_t *pair)
+static int gc_needs_mark(scheme_ctx_t *ctx, cell_t *cell, int young_only)
 {
-  printf("(");
-  while (is_pair(pair)) {
-    print_obj(ctx, _car(pair));
-    pair = _cdr(pair);
-    if (is_pair(pair)) {
-      printf(" ");
-    }
+  if (is_immediate(cell)) {
+    return 0;
   }
-  if (!is_null(ctx, pair)) {
-    printf(". ");
-    print_obj(ctx, pair);
+  segment_t *seg = segment_of(cell);
+  if (get_bit(mark, seg, cell)) {
+    return 0;
   }
-  printf(")");
+  return !young_only || !get_bit(old, seg, cell);
 }
 
-void print_obj(scheme_ctx_t *ctx, cell_t *obj) {
-  switch ((obj)->type) {
-    case CELL_T_PRIMOP:
-      printf("<primop>");
-      break;
-    case CELL_T_SYMBOL:
-      printf("%s", obj->u.symbol);
-      break;
-    case CELL_T_STRING:
-      printf("\"%s\"", obj->u.string);
-      break;
+static void gc_mark_cell(scheme_ctx_t *ctx, cell_t *cell)
+{
+  segment_t *seg = segment_of(cell);
+  set_bit(mark, seg, cell);
+  seg->marked += 1;
+}
+
+/* mark a cell and queue it for scanning. When the mark stack is full the
+ * cell stays unscanned and gc_mark_overflow() picks it up later */
+static void gc_mark_push(scheme_ctx_t *ctx, cell_t *cell)
+{
+  gc_mark_cell(ctx, cell);
+  if (ctx->mark_stack_pos < MARK_STACK_SIZE) {
+    ctx->mark_stack[ctx->mark_stack_pos ++] = cell;
+  } else {
+    ctx->mark_overflow = 1;
+  }
+}
+
+/* the two pointers held by cell, returns 0 if it holds none and
+ * GC_CHILDREN_RECORD for records, which gc_scan_record() handles */
+#define GC_CHILDREN_RECORD 2
+static int gc_cell_children(cell_t *cell, cell_t **a, cell_t **b)
+{
+  enum cell_type_e type = heap_cell_type(cell);
+  if (type >= CELL_T_FRAME) {
+    return GC_CHILDREN_RECORD;
+  }
+  switch(type) {
     case CELL_T_PAIR:
-      print_pair(ctx, obj);
-      break;
-    case CELL_T_INTEGER:
-      printf("%i", obj->u.integer);
-      break;
+      *a = cell->u.pair.car;
+      *b = cell->u.pair.cdr;
+      return 1;
     case CELL_T_LAMBDA:
-      printf("<lambda>");
-      break;
     case CELL_T_MACRO:
-      printf("<macro>");
-      break;
+      *a = cell->u.lambda.proc;
+      *b = cell->u.lambda.env;
+      return 1;
+    case CELL_T_SYMBOL:
+      *a = cell->u.symbol.value;
+      *b = CONSTANT_NIL;
+      return 1;
     default:
-      if (is_null(ctx, obj)) {
-        printf("()");
-      } else if (is_true(ctx, obj)) {
-        printf("#t");
-      } else if (is_false(ctx, obj)) {
-        printf("#f");
-      } else {
-        printf("<unknown>");
-      }
-      break;
+      return 0;
   }
 }
 
-static char *get_type_name(int type)
+/* mark the cells a record occupies besides its header, queue its slots */
+static void gc_scan_record(scheme_ctx_t *ctx, cell_t *cell, int young_only)
 {
-  return cell_type_names[type];
+  segment_t *seg = segment_of(cell);
+  size_t size = cell->u.record.size;
+  size_t first = cell - seg->cells + 1;
+  seg->marked += bitmap_mark_range(seg->mark, first,
+      first + record_cells(size) - 1);
+  cell_t **slots = record_slots(cell);
+  for (size_t i = 0; i < size; ++i) {
+    if (gc_needs_mark(ctx, slots[i], young_only)) {
+      gc_mark_push(ctx, slots[i]);
+    }
+  }
 }
 
-int list_length(cell_t *args)
+static void gc_mark_children(scheme_ctx_t *ctx, cell_t *cell, int young_only)
 {
-  int ret = 0;
-  while (is_pair(args)) {
-    ++ret;
+  for (;;) {
+    cell_t *a, *b;
+    switch (gc_cell_children(cell, &a, &b)) {
+      case 0:
+        return;
+      case GC_CHILDREN_RECORD:
+        gc_scan_record(ctx, cell, young_only);
+        return;
+    }
+    if (gc_needs_mark(ctx, a, young_only)) {
+      gc_mark_push(ctx, a);
+    }
+    if (!gc_needs_mark(ctx, b, young_only)) {
+      return;
+    }
+    /* follow the second pointer directly, long lists need no stack */
+    gc_mark_cell(ctx, b);
+    cell = b;
+  }
+}
+
+static void gc_mark_drain(scheme_ctx_t *ctx, int young_only)
+{
+  while (ctx->mark_stack_pos) {
+    gc_mark_children(ctx, ctx->mark_stack[-- ctx->mark_stack_pos], young_only);
+  }
+}
+
+/* Rescan marked cells after the mark stack overflowed. Young cells only
+ * live in the nursery, so a minor gc just has to look at that segment. */
+static void gc_mark_overflow(scheme_ctx_t *ctx, segment_t *seg, int young_only)
+{
+  while (ctx->mark_overflow) {
+    ctx->mark_overflow = 0;
+    for (segment_t *s = seg ? seg : ctx->segments; s; s = seg ? NULL : s->next) {
+      for (int w = 0; w < SEGMENT_WORDS; ++w) {
+        uint64_t bits = s->mark[w] & (young_only ? ~s->old[w] : ~(uint64_t)0);
+        while (bits) {
+          cell_t *c = s->cells + w * 64 + __builtin_ctzll(bits);
+          bits &= bits - 1;
+          gc_mark_children(ctx, c, young_only);
+          gc_mark_drain(ctx, young_only);
+        }
+      }
+    }
+  }
+}
+
+static void gc_mark(scheme_ctx_t *ctx, cell_t *cell, int young_only)
+{
+  if (gc_needs_mark(ctx, cell, young_only)) {
+    gc_mark_cell(ctx, cell);
+    gc_mark_children(ctx, cell, young_only);
+    gc_mark_drain(ctx, young_only);
+  }
+}
+
+static void gc_mark_roots(scheme_ctx_t *ctx, int young_only)
+{
+  for(size_t i = 0; i < ctx->roots_pos; ++i) {
+    gc_mark(ctx, ctx->roots[i], young_only);
+  }
+  gc_mark(ctx, ctx->syms, young_only);
+  gc_mark(ctx, ctx->frame, young_only);
+}
+
+/* ------------------------------ pause times ------------------------------ */
+
+static uint64_t gc_clock(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int pause_bucket(uint64_t ns)
+{
+  if (ns < 16) {
+    return ns;
+  }
+  int e = 63 - __builtin_clzll(ns);
+  return (e - 3) * 16 + ((ns >> (e - 4)) & 15);
+}
+
+/* largest pause that falls into bucket i */
+static uint64_t pause_bucket_limit(int i)
+{
+  if (i < 16) {
+    return i;
+  }
+  int e = i / 16 + 3;
+  return ((uint64_t)(16 + i % 16 + 1) << (e - 4)) - 1;
+}
+
+/* the program was stopped for the gc since 'start' */
+static void gc_pause_end(scheme_ctx_t *ctx, uint64_t start)
+{
+  uint64_t ns = gc_clock() - start;
+  ctx->pause_count += 1;
+  ctx->pause_histogram[pause_bucket(ns)] += 1;
+  if (ns > ctx->pause_max) {
+    ctx->pause_max = ns;
+  }
+}
+
+static uint64_t gc_pause_percentile(scheme_ctx_t *ctx, int percent)
+{
+  unsigned long want = (ctx->pause_count * percent + 99) / 100;
+  unsigned long seen = 0;
+  for (int i = 0; i < PAUSE_BUCKETS; ++i) {
+    seen += ctx->pause_histogram[i];
+    if (seen >= want && seen) {
+      uint64_t limit = pause_bucket_limit(i);
+      return limit < ctx->pause_max ? limit : ctx->pause_max;
+    }
+  }
+  return 0;
+}
+
+/* Collect the nursery segment only. Roots are the usual ones plus the
+ * remembered set; because marking never enters old cells the work done is
+ * proportional to the young data still alive. Survivors are promoted in
+ * place. */
+static void gc_minor(scheme_ctx_t *ctx)
+{
+  uint64_t start = gc_clock();
+  segment_t *seg = ctx->nursery;
+  nursery_release_run(ctx);
+  for (int i = 0; i < ctx->remembered_pos; ++i) {
+    gc_mark_children(ctx, ctx->remembered[i], 1);
+    gc_mark_drain(ctx, 1);
+  }
+  gc_mark_roots(ctx, 1);
+  gc_mark_overflow(ctx, seg, 1);
+
+  for (int w = 0; w < SEGMENT_WORDS; ++w) {
+    uint64_t young = seg->used[w] & ~seg->old[w];
+    uint64_t dead = young & ~seg->mark[w];
+    if (dead) {
+      int n = __builtin_popcountll(dead);
+      seg->used[w] &= ~dead;
+      ctx->memory_in_use -= n;
+      ctx->cells_freed += n;
+    }
+    ctx->cells_promoted += __builtin_popcountll(young & seg->mark[w]);
+    seg->old[w] = seg->used[w];
+    seg->mark[w] = 0;
+  }
+  seg->marked = 0;
+  gc_forget_remembered(ctx);
+  ctx->nursery_in_use = 0;
+  ctx->gc_minor_runs += 1;
+  gc_pause_end(ctx, start);
+}
+
+/* ------------------------------ string heap ------------------------------ */
+
+static string_chunk_t *string_chunk_new(scheme_ctx_t *ctx, size_t size)
+{
+  if (heap_over_limit(ctx, ctx->memory_size, ctx->string_heap_size + size)) {
+    scheme_error(ctx, "out of memory");
+  }
+  string_chunk_t *chunk = malloc(sizeof(string_chunk_t) + size + 15);
+  if (!chunk) {
+    scheme_error(ctx, "out of memory");
+  }
+  chunk->next = NULL;
+  chunk->size = size;
+  chunk->pos = 0;
+  chunk->live = 0;
+  chunk->data = (char *)(((uintptr_t)(chunk + 1) + 15) & ~(uintptr_t)15);
+  ctx->string_heap_size += size;
+  return chunk;
+}
+
+/* size of the chunk to allocate a block of 'size' bytes from */
+static size_t string_chunk_size(size_t size)
+{
+  return size > STRING_CHUNK_SIZE / 4 ? size : STRING_CHUNK_SIZE;
+}
+
+static void string_chunk_append(scheme_ctx_t *ctx, string_chunk_t *chunk)
+{
+  if (ctx->string_chunk) {
+    ctx->string_chunk->next = chunk;
+  } else {
+    ctx->string_chunks = chunk;
+  }
+  ctx->string_chunk = chunk;
+}
+
+/* Allocate the payload of a string cell, a copy of str or left for the
+ * caller to fill if str is NULL. This never collects, so it is safe to
+ * call with 'str' pointing into another string. */
+static char *string_alloc(scheme_ctx_t *ctx, cell_t *owner, char *str, size_t len)
+{
+  size_t size = string_block_size(len);
+  string_chunk_t *chunk = ctx->string_chunk;
+  if (!chunk || chunk->size - chunk->pos < size) {
+    chunk = string_chunk_new(ctx, string_chunk_size(size));
+    string_chunk_append(ctx, chunk);
+  }
+  string_block_t *block = (string_block_t *)(chunk->data + chunk->pos);
+  chunk->pos += size;
+  block->owner = owner;
+  block->len = len;
+  if (str) {
+    memcpy(block->data, str, len);
+  }
+  block->data[len] = '\0';
+  /* ask for a full collection once the string heap doubled */
+  ctx->string_allocated += size;
+  if (ctx->string_allocated > ctx->string_heap_live
+      && ctx->string_allocated > STRING_CHUNK_SIZE * 4) {
+    ctx->gc_requested = 1;
+  }
+  return block->data;
+}
+
+/* Called by gc_collect while the mark bits are exact and before any segment
+ * is unmapped: forget blocks whose owner was not marked. */
+static void string_sweep(scheme_ctx_t *ctx)
+{
+  size_t live = 0;
+  for (string_chunk_t *chunk = ctx->string_chunks; chunk; chunk = chunk->next) {
+    chunk->live = 0;
+    for (size_t pos = 0; pos < chunk->pos; ) {
+      string_block_t *block = (string_block_t *)(chunk->data + pos);
+      size_t size = string_block_size(block->len);
+      cell_t *owner = block->owner;
+      if (owner) {
+        segment_t *seg = segment_of(owner);
+        enum cell_type_e type = heap_cell_type(owner);
+        if (!get_bit(mark, seg, owner)
+            || (type != CELL_T_STRING && type != CELL_T_BIGNUM
+              && type != CELL_T_BYTEVECTOR)
+            || owner->u.string != block->data) {
+          block->owner = NULL;
+        } else {
+          chunk->live += size;
+        }
+      }
+      pos += size;
+    }
+    live += chunk->live;
+  }
+  ctx->string_heap_live = live;
+  ctx->string_allocated = 0;
+}
+
+/* Copy all live blocks into fresh chunks and free the old ones. */
+static void string_compact(scheme_ctx_t *ctx)
+{
+  string_chunk_t *chunks = ctx->string_chunks;
+  ctx->string_chunks = ctx->string_chunk = NULL;
+  ctx->string_heap_size = 0;
+  while (chunks) {
+    string_chunk_t *chunk = chunks;
+    chunks = chunk->next;
+    for (size_t pos = 0; pos < chunk->pos; ) {
+      string_block_t *block = (string_block_t *)(chunk->data + pos);
+      if (block->owner) {
+        block->owner->u.string = string_alloc(ctx, block->owner,
+            block->data, block->len);
+      }
+      pos += string_block_size(block->len);
+    }
+    free(chunk);
+  }
+  ctx->string_allocated = 0;
+  ctx->string_compactions += 1;
+}
+
+/* If a block of len bytes would take the string heap past the maximum heap
+ * size, collect and compact it first. This may collect, call it before
+ * allocating the owner. */
+static void string_reserve(scheme_ctx_t *ctx, size_t len)
+{
+  size_t size = string_block_size(len);
+  string_chunk_t *chunk = ctx->string_chunk;
+  if ((!chunk || chunk->size - chunk->pos < size)
+      && heap_over_limit(ctx, ctx->memory_size,
+        ctx->string_heap_size + string_chunk_size(size))) {
+    gc_collect(ctx);
+    if (ctx->string_heap_live < ctx->string_heap_size) {
+      string_compact(ctx);
+    }
+  }
+}
+
+static char *symbol_name_alloc(scheme_ctx_t *ctx, char *str, size_t len,
+    uint32_t hash)
+{
+  size_t need = (sizeof(symbol_name_t) + len + 1 + 7) & ~(size_t)7;
+  if (ctx->symbol_arena_left < need) {
+    size_t size = need > SYMBOL_ARENA_SIZE / 4 ? need : SYMBOL_ARENA_SIZE;
+    ctx->symbol_arena = malloc(size);
+    if (!ctx->symbol_arena) {
+      scheme_error(ctx, "out of memory");
+    }
+    ctx->symbol_arena_left = size;
+  }
+  symbol_name_t *name = (symbol_name_t *)ctx->symbol_arena;
+  name->hash = hash;
+  name->len = len;
+  memcpy(name->name, str, len);
+  name->name[len] = '\0';
+  ctx->symbol_arena += need;
+  ctx->symbol_arena_left -= need;
+  return name->name;
+}
+
+/* FNV-1a */
+static uint32_t symbol_hash(char *str, size_t len)
+{
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < len; ++i) {
+    hash = (hash ^ (unsigned char)str[i]) * 16777619u;
+  }
+  return hash;
+}
+
+static void symtab_insert(symtab_entry_t *tab, size_t size, uint32_t hash,
+    cell_t *symbol)
+{
+  size_t i = hash & (size - 1);
+  while (tab[i].symbol) {
+    i = (i + 1) & (size - 1);
+  }
+  tab[i].hash = hash;
+  tab[i].symbol = symbol;
+}
+
+/* keep the table at most half full */
+static void symtab_grow(scheme_ctx_t *ctx)
+{
+  size_t size = ctx->symtab_size ? ctx->symtab_size * 2 : INITIAL_SYMTAB_SIZE;
+  symtab_entry_t *tab = calloc(size, sizeof(symtab_entry_t));
+  if (!tab) {
+    scheme_error(ctx, "out of memory");
+  }
+  for (size_t i = 0; i < ctx->symtab_size; ++i) {
+    if (ctx->symtab[i].symbol) {
+      symtab_insert(tab, size, ctx->symtab[i].hash, ctx->symtab[i].symbol);
+    }
+  }
+  free(ctx->symtab);
+  ctx->symtab = tab;
+  ctx->symtab_size = size;
+}
+
+/* End of a full collection, all reachable cells are marked. */
+static void gc_finish(scheme_ctx_t *ctx)
+{
+  size_t memory_in_use = 0;
+
+  gc_mark_overflow(ctx, NULL, 0);
+  for (segment_t *seg = ctx->segments; seg; seg = seg->next) {
+    seg->unswept = 1;
+    seg->in_use = seg->marked;
+    memory_in_use += seg->marked;
+  }
+
+  string_sweep(ctx);
+  if (ctx->string_heap_size - ctx->string_heap_live > ctx->string_heap_live
+      && ctx->string_heap_size > STRING_CHUNK_SIZE * 2) {
+    /* more than half of the string heap is garbage */
+    string_compact(ctx);
+  }
+
+  gc_forget_remembered(ctx);
+  ctx->gc_requested = 0;
+  ctx->gc_phase = GC_IDLE;
+  ctx->memory_in_use = memory_in_use;
+  ctx->nursery_in_use = 0;
+  ctx->gc_runs += 1;
+  heap_resize(ctx);
+}
+
+/* Full collection: marks everything reachable and leaves the sweeping to
+ * the allocator (see gc_sweep_segment). Segments without a single marked
+ * cell are empty and may be returned to the OS right away. If an
+ * incremental collection is under way, it is completed. */
+static void gc_collect(scheme_ctx_t *ctx)
+{
+  uint64_t start = gc_clock();
+  nursery_release_run(ctx);
+  if (ctx->gc_phase == GC_MARKING) {
+    while (ctx->gc_snapshot_pos) {
+      gc_mark(ctx, ctx->gc_snapshot[-- ctx->gc_snapshot_pos], 0);
+    }
+    gc_mark_drain(ctx, 0);
+  } else {
+    gc_sweep_all(ctx);
+    for (segment_t *seg = ctx->segments; seg; seg = seg->next) {
+      seg->marked = 0;
+    }
+    gc_mark_roots(ctx, 0);
+  }
+  gc_finish(ctx);
+  gc_pause_end(ctx, start);
+}
+
+/* Begin an incremental collection: the segments still holding the marks of
+ * the last one are swept step by step, then marking starts. */
+static void gc_start_cycle(scheme_ctx_t *ctx)
+{
+  ctx->gc_phase = GC_SWEEPING;
+  ctx->gc_sweep_cursor = ctx->segments;
+}
+
+/* Record the roots. Whatever is reachable from them now is marked by the
+ * following steps, cells allocated from now on are marked on allocation. */
+static void gc_start_marking(scheme_ctx_t *ctx)
+{
+  size_t size = ctx->roots_pos + 2;
+  if (size > ctx->gc_snapshot_size) {
+    cell_t **snapshot = realloc(ctx->gc_snapshot, sizeof(cell_t *) * size);
+    if (!snapshot) {
+      scheme_error(ctx, "out of memory");
+    }
+    ctx->gc_snapshot = snapshot;
+    ctx->gc_snapshot_size = size;
+  }
+  memcpy(ctx->gc_snapshot, ctx->roots, sizeof(cell_t *) * ctx->roots_pos);
+  ctx->gc_snapshot[ctx->roots_pos] = ctx->syms;
+  ctx->gc_snapshot[ctx->roots_pos + 1] = ctx->frame;
+  ctx->gc_snapshot_pos = size;
+  for (segment_t *seg = ctx->segments; seg; seg = seg->next) {
+    seg->marked = 0;
+  }
+  nursery_release_run(ctx);
+  ctx->gc_phase = GC_MARKING;
+}
+
+/* One increment of an incremental collection, about gc_quantum cells worth
+ * of work. Unlike gc_mark_children() a step only scans a single cell at a
+ * time so that long lists do not make it unbounded. */
+static void gc_step(scheme_ctx_t *ctx)
+{
+  uint64_t start = gc_clock();
+  long budget = ctx->gc_quantum;
+  ctx->gc_steps += 1;
+  if (ctx->gc_phase == GC_SWEEPING) {
+    for (; ctx->gc_sweep_cursor && budget > 0;
+        ctx->gc_sweep_cursor = ctx->gc_sweep_cursor->next) {
+      if (ctx->gc_sweep_cursor->unswept) {
+        gc_sweep_segment(ctx, ctx->gc_sweep_cursor);
+        budget -= GC_SWEEP_COST;
+      }
+    }
+    if (!ctx->gc_sweep_cursor) {
+      gc_start_marking(ctx);
+    }
+  }
+  while (ctx->gc_phase == GC_MARKING && budget-- > 0) {
+    cell_t *cell, *a, *b;
+    if (ctx->mark_stack_pos) {
+      cell = ctx->mark_stack[-- ctx->mark_stack_pos];
+      switch (gc_cell_children(cell, &a, &b)) {
+        case 0:
+          break;
+        case GC_CHILDREN_RECORD:
+          gc_scan_record(ctx, cell, 0);
+          budget -= cell->u.record.size / 2;
+          break;
+        default:
+          /* the first pointer is scanned first, like gc_mark_children() */
+          if (gc_needs_mark(ctx, b, 0)) {
+            gc_mark_push(ctx, b);
+          }
+          if (gc_needs_mark(ctx, a, 0)) {
+            gc_mark_push(ctx, a);
+          }
+          break;
+      }
+    } else if (ctx->gc_snapshot_pos) {
+      cell = ctx->gc_snapshot[-- ctx->gc_snapshot_pos];
+      if (gc_needs_mark(ctx, cell, 0)) {
+        gc_mark_push(ctx, cell);
+      }
+    } else {
+      gc_finish(ctx);
+    }
+  }
+  gc_pause_end(ctx, start);
+}
+
+void gc_info(scheme_ctx_t *ctx)
+{
+  printf("%zu cells are free\n", ctx->memory_size - ctx->memory_in_use);
+  printf("heap: %d segments, %zu cells\n", ctx->segment_count, ctx->memory_size);
+  printf("%lu cells allocated, %lu cells freed, %lu cells promoted\n",
+      ctx->cells_allocated, ctx->cells_freed, ctx->cells_promoted);
+  printf("%lu minor and %lu full collections\n",
+      ctx->gc_minor_runs, ctx->gc_runs);
+  printf("string heap: %zu bytes, %zu live, %lu compactions\n",
+      ctx->string_heap_size, ctx->string_heap_live, ctx->string_compactions);
+  printf("%lu gc pauses (%lu incremental steps), max %.1f us, p99 %.1f us\n",
+      ctx->pause_count, ctx->gc_steps, ctx->pause_max / 1000.0,
+      gc_pause_percentile(ctx, 99) / 1000.0);
+  printf("call depth: %zu max, root stack %zu slots\n",
+      ctx->depth_high, ctx->roots_size);
+}
+
+#define _car(obj) ((obj)->u.pair.car)
+#define _cdr(obj) ((obj)->u.pair.cdr)
+#define is_integer(obj) (is_fixnum(obj) || cell_type(obj) == CELL_T_BIGNUM)
+#define is_flonum(obj) (cell_type(obj) == CELL_T_FLONUM)
+#define is_number(obj) (is_integer(obj) || is_flonum(obj))
+#define is_null(ctx, obj) ((ctx)->NIL == obj)
+#define is_sym(obj) (cell_type(obj) == CELL_T_SYMBOL)
+#define is_pair(obj) (cell_type(obj) == CELL_T_PAIR)
+#define is_true(ctx, obj) ((obj) != (ctx)->FALSE)
+#define is_false(ctx, obj) ((obj) == (ctx)->FALSE)
+#define is_primop(obj) (cell_type(obj) == CELL_T_PRIMOP)
+#define is_lambda(obj) (cell_type(obj) == CELL_T_LAMBDA)
+#define is_macro(obj) (cell_type(obj) == CELL_T_MACRO)
+#define is_proc(obj) (cell_type(obj) == CELL_T_PROC)
+/* symbols */
+
+static int get_args(cell_t *args, int nr, int types[], cell_t *ret[]);
+
+cell_t *mk_symbol(scheme_ctx_t *ctx, char *str)
+{
+  size_t len = strlen(str);
+  uint32_t hash = symbol_hash(str, len);
+  size_t mask = ctx->symtab_size - 1;
+  for (size_t i = hash & mask; ctx->symtab[i].symbol; i = (i + 1) & mask) {
+    if (ctx->symtab[i].hash == hash) {
+      cell_t *sym = ctx->symtab[i].symbol;
+      if (symbol_name(sym->u.symbol.name)->len == len
+          && !memcmp(sym->u.symbol.name, str, len)) {
+        return sym;
+      }
+    }
+  }
+  /* add new entry */
+  cell_t *ret = get_cell(ctx);
+  set_cell_type(ret, CELL_T_SYMBOL);
+  ret->u.symbol.name = symbol_name_alloc(ctx, str, len, hash);
+  ret->u.symbol.value = CONSTANT_UNBOUND;
+  ctx->syms = cons(ctx, ret, ctx->syms);
+  if ((ctx->symtab_count + 1) * 2 > ctx->symtab_size) {
+    symtab_grow(ctx);
+  }
+  symtab_insert(ctx->symtab, ctx->symtab_size, hash, ret);
+  ctx->symtab_count += 1;
+  return ret;
+}
+
+cell_t *mk_primop(scheme_ctx_t *ctx, const primop_t *primop)
+{
+  cell_t *ret = get_cell(ctx);
+  set_cell_type(ret, CELL_T_PRIMOP);
+  ret->u.primop = primop;
+  return ret;
+}
+
+cell_t *mk_string(scheme_ctx_t *ctx, char* str)
+{
+  string_reserve(ctx, strlen(str));
+  cell_t *ret = get_cell(ctx);
+  set_cell_type(ret, CELL_T_STRING);
+  ret->u.string = string_alloc(ctx, ret, str, strlen(str));
+  return ret;
+}
+
+/* ------------------------------ bignums ------------------------------ */
+
+/* Integers are fixnums as long as they fit 63 bits and bignums beyond that:
+ * a sign and a magnitude of base 2^32 digits. The arithmetic below works on
+ * plain digit arrays allocated with malloc(), only mk_bignum() puts the
+ * result on the heap, so no pointer into the string heap is held across an
+ * allocation. */
+#define KARATSUBA_THRESHOLD 32  /* digits, below it schoolbook is faster */
+#define DECIMAL_BASE 1000000000  /* decimal conversion goes 9 digits a step */
+#define DECIMAL_DIGITS 9
+
+/* the magnitude of an integer, a fixnum keeps its digits in 'small' */
+typedef struct {
+  uint32_t *digits;
+  size_t size;
+  int neg;
+  uint32_t small[2];
+} bignum_t;
+
+static void bignum_view(cell_t *obj, bignum_t *b)
+{
+  if (is_fixnum(obj)) {
+    intptr_t v = fixnum_value(obj);
+    uint64_t m = v < 0 ? -(uint64_t)v : (uint64_t)v;
+    b->neg = v < 0;
+    b->small[0] = (uint32_t)m;
+    b->small[1] = (uint32_t)(m >> 32);
+    b->digits = b->small;
+    b->size = b->small[1] ? 2 : m != 0;
+  } else {
+    b->neg = obj->u.bignum.size < 0;
+    b->digits = obj->u.bignum.digits;
+    b->size = b->neg ? -obj->u.bignum.size : obj->u.bignum.size;
+  }
+}
+
+static uint32_t *digits_alloc(scheme_ctx_t *ctx, size_t size)
+{
+  uint32_t *ret = malloc((size + 1) * sizeof(uint32_t));
+  if (!ret) {
+    scheme_error(ctx, "out of memory");
+  }
+  return ret;
+}
+
+static size_t digits_trim(const uint32_t *a, size_t an)
+{
+  while (an && !a[an - 1]) {
+    an -= 1;
+  }
+  return an;
+}
+
+static int digits_cmp(const uint32_t *a, size_t an,
+    const uint32_t *b, size_t bn)
+{
+  an = digits_trim(a, an);
+  bn = digits_trim(b, bn);
+  if (an != bn) {
+    return an < bn ? -1 : 1;
+  }
+  while (an--) {
+    if (a[an] != b[an]) {
+      return a[an] < b[an] ? -1 : 1;
+    }
+  }
+  return 0;
+}
+
+/* r[0..rn) += a[0..an), an <= rn and the sum has to fit */
+static void digits_add_to(uint32_t *r, size_t rn, const uint32_t *a, size_t an)
+{
+  uint64_t carry = 0;
+  size_t i;
+  for (i = 0; i < an; ++i) {
+    carry += (uint64_t)r[i] + a[i];
+    r[i] = (uint32_t)carry;
+    carry >>= 32;
+  }
+  for (; carry && i < rn; ++i) {
+    carry += r[i];
+    r[i] = (uint32_t)carry;
+    carry >>= 32;
+  }
+}
+
+/* r[0..rn) -= a[0..an), r must not be the smaller one */
+static void digits_sub_from(uint32_t *r, size_t rn,
+    const uint32_t *a, size_t an)
+{
+  int64_t borrow = 0;
+  size_t i;
+  for (i = 0; i < an; ++i) {
+    borrow += (int64_t)r[i] - a[i];
+    r[i] = (uint32_t)borrow;
+    borrow >>= 32;
+  }
+  for (; borrow && i < rn; ++i) {
+    borrow += r[i];
+    r[i] = (uint32_t)borrow;
+    borrow >>= 32;
+  }
+}
+
+/* r[0..max(an, bn) + 1) = a + b, returns the size of the sum */
+static size_t digits_add(uint32_t *r, const uint32_t *a, size_t an,
+    const uint32_t *b, size_t bn)
+{
+  if (an < bn) {
+    const uint32_t *t = a;
+    a = b;
+    b = t;
+    size_t tn = an;
+    an = bn;
+    bn = tn;
+  }
+  memcpy(r, a, an * sizeof(uint32_t));
+  r[an] = 0;
+  digits_add_to(r, an + 1, b, bn);
+  return digits_trim(r, an + 1);
+}
+
+/* r[0..an + bn) = a * b, r must not overlap a or b. Karatsuba splits a
+ * and b in halves and gets by with three products of half the size:
+ * a1 b1, a0 b0 and (a0 + a1)(b0 + b1), the middle term is the last minus
+ * the other two. */
+static void digits_mul(scheme_ctx_t *ctx, uint32_t *r, const uint32_t *a,
+    size_t an, const uint32_t *b, size_t bn)
+{
+  if (an < bn) {
+    const uint32_t *t = a;
+    a = b;
+    b = t;
+    size_t tn = an;
+    an = bn;
+    bn = tn;
+  }
+  memset(r, 0, (an + bn) * sizeof(uint32_t));
+  if (bn < KARATSUBA_THRESHOLD) {
+    for (size_t j = 0; j < bn; ++j) {
+      uint64_t carry = 0;
+      for (size_t i = 0; i < an; ++i) {
+        carry += (uint64_t)a[i] * b[j] + r[i + j];
+        r[i + j] = (uint32_t)carry;
+        carry >>= 32;
+      }
+      r[an + j] = (uint32_t)carry;
+    }
+    return;
+  }
+  if (an >= 2 * bn) {
+    /* lopsided: multiply b by pieces of a its own size */
+    uint32_t *t = digits_alloc(ctx, 2 * bn);
+    for (size_t i = 0; i < an; i += bn) {
+      size_t len = an - i < bn ? an - i : bn;
+      digits_mul(ctx, t, a + i, len, b, bn);
+      digits_add_to(r + i, an + bn - i, t, len + bn);
+    }
+    free(t);
+    return;
+  }
+  size_t m = an / 2;  /* bn > m, so both high halves are non empty */
+  uint32_t *sa = digits_alloc(ctx, an - m + 1);
+  uint32_t *sb = digits_alloc(ctx, (bn - m > m ? bn - m : m) + 1);
+  size_t san = digits_add(sa, a + m, an - m, a, m);
+  size_t sbn = digits_add(sb, b + m, bn - m, b, m);
+  uint32_t *mid = digits_alloc(ctx, san + sbn);
+  digits_mul(ctx, mid, sa, san, sb, sbn);
+  free(sa);
+  free(sb);
+  /* a0 b0 and a1 b1 go straight to their place in r */
+  digits_mul(ctx, r, a, m, b, m);
+  digits_mul(ctx, r + 2 * m, a + m, an - m, b + m, bn - m);
+  size_t midn = digits_trim(mid, san + sbn);
+  digits_sub_from(mid, midn, r, digits_trim(r, 2 * m));
+  digits_sub_from(mid, midn, r + 2 * m,
+      digits_trim(r + 2 * m, an + bn - 2 * m));
+  digits_add_to(r + m, an + bn - m, mid, digits_trim(mid, midn));
+  free(mid);
+}
+
+/* q[0..an - bn] = a / b and, unless rem is NULL, rem[0..bn) = a % b,
+ * for an >= bn and b[bn - 1] != 0. Knuth's algorithm D. */
+static void digits_divmod(scheme_ctx_t *ctx, uint32_t *q, uint32_t *rem,
+    const uint32_t *a, size_t an, const uint32_t *b, size_t bn)
+{
+  if (bn == 1) {
+    uint64_t r = 0;
+    for (size_t i = an; i-- > 0; ) {
+      r = (r << 32) | a[i];
+      q[i] = (uint32_t)(r / b[0]);
+      r %= b[0];
+    }
+    if (rem) {
+      rem[0] = (uint32_t)r;
+    }
+    return;
+  }
+  /* shift b so its top digit has the high bit set, that keeps the
+   * estimate of each quotient digit off by at most two */
+  int s = __builtin_clz(b[bn - 1]);
+  uint32_t *u = digits_alloc(ctx, an + 1);
+  uint32_t *v = digits_alloc(ctx, bn);
+  for (size_t i = bn - 1; i > 0; --i) {
+    v[i] = (b[i] << s) | (uint32_t)((uint64_t)b[i - 1] >> (32 - s));
+  }
+  v[0] = b[0] << s;
+  u[an] = (uint32_t)((uint64_t)a[an - 1] >> (32 - s));
+  for (size_t i = an - 1; i > 0; --i) {
+    u[i] = (a[i] << s) | (uint32_t)((uint64_t)a[i - 1] >> (32 - s));
+  }
+  u[0] = a[0] << s;
+  for (size_t j = an - bn + 1; j-- > 0; ) {
+    uint64_t top = ((uint64_t)u[j + bn] << 32) | u[j + bn - 1];
+    uint64_t qhat = top / v[bn - 1];
+    uint64_t rhat = top % v[bn - 1];
+    while ((qhat >> 32)
+        || qhat * v[bn - 2] > ((rhat << 32) | u[j + bn - 2])) {
+      qhat -= 1;
+      rhat += v[bn - 1];
+      if (rhat >> 32) {
+        break;
+      }
+    }
+    /* u -= qhat * v, add v back once if that went below zero */
+    int64_t borrow = 0;
+    int64_t t;
+    for (size_t i = 0; i < bn; ++i) {
+      uint64_t p = qhat * v[i];
+      t = (int64_t)u[i + j] - borrow - (int64_t)(p & 0xffffffff);
+      u[i + j] = (uint32_t)t;
+      borrow = (int64_t)(p >> 32) - (t >> 32);
+    }
+    t = (int64_t)u[j + bn] - borrow;
+    u[j + bn] = (uint32_t)t;
+    q[j] = (uint32_t)qhat;
+    if (t < 0) {
+      q[j] -= 1;
+      uint64_t carry = 0;
+      for (size_t i = 0; i < bn; ++i) {
+        carry += (uint64_t)u[i + j] + v[i];
+        u[i + j] = (uint32_t)carry;
+        carry >>= 32;
+      }
+      u[j + bn] += (uint32_t)carry;
+    }
+  }
+  if (rem) {
+    for (size_t i = 0; i < bn; ++i) {
+      rem[i] = (u[i] >> s) | (uint32_t)((uint64_t)u[i + 1] << (32 - s));
+    }
+  }
+  free(u);
+  free(v);
+}
+
+/* the integer digits[0..size) with the given sign, a fixnum if it fits.
+ * digits must not point into the string heap. */
+static cell_t *mk_bignum(scheme_ctx_t *ctx, const uint32_t *digits,
+    size_t size, int neg)
+{
+  size = digits_trim(digits, size);
+  if (size == 0) {
+    return mk_fixnum(0);
+  }
+  if (size <= 2) {
+    uint64_t m = size == 2 ? (uint64_t)digits[1] << 32 | digits[0] : digits[0];
+    if (m <= (uint64_t)FIXNUM_MAX + neg) {
+      return mk_fixnum(neg ? -(intptr_t)m : (intptr_t)m);
+    }
+  }
+  string_reserve(ctx, size * sizeof(uint32_t));
+  cell_t *ret = get_cell(ctx);
+  set_cell_type(ret, CELL_T_BIGNUM);
+  ret->u.bignum.size = neg ? -(intptr_t)size : (intptr_t)size;
+  ret->u.bignum.digits = (uint32_t *)string_alloc(ctx, ret,
+      (char *)digits, size * sizeof(uint32_t));
+  return ret;
+}
+
+static cell_t *mk_uint64(scheme_ctx_t *ctx, uint64_t value)
+{
+  uint32_t digits[2] = {(uint32_t)value, (uint32_t)(value >> 32)};
+  return mk_bignum(ctx, digits, 2, 0);
+}
+
+cell_t *mk_integer(scheme_ctx_t *ctx, intptr_t integer)
+{
+  if (fixnum_fits(integer)) {
+    return mk_fixnum(integer);
+  }
+  uint64_t m = integer < 0 ? -(uint64_t)integer : (uint64_t)integer;
+  uint32_t digits[2] = {(uint32_t)m, (uint32_t)(m >> 32)};
+  return mk_bignum(ctx, digits, 2, integer < 0);
+}
+
+/* x op y for op one of + - * / %, where / truncates and % takes the sign
+ * of x like C does. Used when a fixnum operation overflows or an argument
+ * is a bignum. */
+static cell_t *bignum_op(scheme_ctx_t *ctx, int op, cell_t *x, cell_t *y)
+{
+  bignum_t a, b;
+  bignum_view(x, &a);
+  bignum_view(y, &b);
+  uint32_t *r;
+  size_t size;
+  int neg;
+  switch (op) {
+    case '-':
+      b.neg = !b.neg;
+      /* fall through */
+    case '+':
+      r = digits_alloc(ctx, (a.size > b.size ? a.size : b.size) + 1);
+      if (a.neg == b.neg) {
+        size = digits_add(r, a.digits, a.size, b.digits, b.size);
+        neg = a.neg;
+      } else if (digits_cmp(a.digits, a.size, b.digits, b.size) >= 0) {
+        memcpy(r, a.digits, a.size * sizeof(uint32_t));
+        digits_sub_from(r, a.size, b.digits, b.size);
+        size = a.size;
+        neg = a.neg;
+      } else {
+        memcpy(r, b.digits, b.size * sizeof(uint32_t));
+        digits_sub_from(r, b.size, a.digits, a.size);
+        size = b.size;
+        neg = b.neg;
+      }
+      break;
+    case '*':
+      size = a.size + b.size;
+      r = digits_alloc(ctx, size);
+      digits_mul(ctx, r, a.digits, a.size, b.digits, b.size);
+      neg = a.neg != b.neg;
+      break;
+    default:
+      if (b.size == 0) {
+        printf("ERROR: division by zero\n");
+        return ctx->NIL;
+      }
+      if (a.size < b.size) {
+        return op == '/' ? mk_fixnum(0) : x;
+      }
+      r = digits_alloc(ctx, a.size);
+      if (op == '/') {
+        size = a.size - b.size + 1;
+        digits_divmod(ctx, r, NULL, a.digits, a.size, b.digits, b.size);
+        neg = a.neg != b.neg;
+      } else {
+        uint32_t *q = digits_alloc(ctx, a.size - b.size + 1);
+        size = b.size;
+        digits_divmod(ctx, q, r, a.digits, a.size, b.digits, b.size);
+        free(q);
+        neg = a.neg;
+      }
+      break;
+  }
+  cell_t *ret = mk_bignum(ctx, r, size, neg);
+  free(r);
+  return ret;
+}
+
+/* -1, 0 or 1 as x is less than, equal to or greater than y */
+static int integer_cmp(cell_t *x, cell_t *y)
+{
+  if (is_fixnum(x) && is_fixnum(y)) {
+    intptr_t a = fixnum_value(x);
+    intptr_t b = fixnum_value(y);
+    return (a > b) - (a < b);
+  }
+  bignum_t a, b;
+  bignum_view(x, &a);
+  bignum_view(y, &b);
+  if (a.neg != b.neg) {
+    return a.neg ? -1 : 1;
+  }
+  int cmp = digits_cmp(a.digits, a.size, b.digits, b.size);
+  return a.neg ? -cmp : cmp;
+}
+
+/* ------------------------------ flonums ------------------------------ */
+
+/* Inexact numbers are boxed doubles. An operation with a flonum argument
+ * gives a flonum, integers are converted. */
+cell_t *mk_flonum(scheme_ctx_t *ctx, double value)
+{
+  cell_t *ret = get_cell(ctx);
+  set_cell_type(ret, CELL_T_FLONUM);
+  ret->u.flonum = value;
+  return ret;
+}
+
+static double number_to_double(cell_t *obj)
+{
+  if (is_fixnum(obj)) {
+    return fixnum_value(obj);
+  } else if (is_flonum(obj)) {
+    return obj->u.flonum;
+  }
+  bignum_t a;
+  bignum_view(obj, &a);
+  double ret = 0;
+  for (size_t i = a.size; i-- > 0; ) {
+    ret = ret * 4294967296.0 + a.digits[i];
+  }
+  return a.neg ? -ret : ret;
+}
+
+/* the integer part of value, () with an error for infinities and NaN */
+static cell_t *double_to_integer(scheme_ctx_t *ctx, double value)
+{
+  if (isnan(value) || isinf(value)) {
+    printf("ERROR: no exact value for %f\n", value);
+    return ctx->NIL;
+  }
+  if (value > FIXNUM_MIN - 1.0 && value < FIXNUM_MAX + 1.0) {
+    return mk_fixnum((intptr_t)value);
+  }
+  /* from here on value has no fraction: mantissa * 2^exponent */
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  uint64_t mantissa = (bits & (((uint64_t)1 << 52) - 1)) | ((uint64_t)1 << 52);
+  int exponent = (int)((bits >> 52) & 0x7ff) - 1075;
+  if (exponent < 0) {
+    mantissa >>= -exponent;
+    exponent = 0;
+  }
+  size_t size = exponent / 32 + 3;
+  uint32_t *r = digits_alloc(ctx, size);
+  memset(r, 0, size * sizeof(uint32_t));
+  uint64_t low = mantissa << (exponent % 32);
+  r[exponent / 32] = (uint32_t)low;
+  r[exponent / 32 + 1] = (uint32_t)(low >> 32);
+  r[exponent / 32 + 2] = (uint32_t)((mantissa >> 32) >> (32 - exponent % 32));
+  cell_t *ret = mk_bignum(ctx, r, size, value < 0);
+  free(r);
+  return ret;
+}
+
+/* x op y for op one of + - * / %, when the fixnum fast path does not do */
+static cell_t *number_op(scheme_ctx_t *ctx, int op, cell_t *x, cell_t *y)
+{
+  if (!is_flonum(x) && !is_flonum(y)) {
+    return bignum_op(ctx, op, x, y);
+  }
+  double a = number_to_double(x);
+  double b = number_to_double(y);
+  switch (op) {
+    case '+':
+      return mk_flonum(ctx, a + b);
+    case '-':
+      return mk_flonum(ctx, a - b);
+    case '*':
+      return mk_flonum(ctx, a * b);
+    default:
+      return mk_flonum(ctx, a / b);
+  }
+}
+
+/* x op y for a comparison op, as doubles if one of them is a flonum */
+#define number_compare(x, y, op) \
+  (is_flonum(x) || is_flonum(y) \
+      ? number_to_double(x) op number_to_double(y) : integer_cmp(x, y) op 0)
+
+static cell_t *number_add(scheme_ctx_t *ctx, cell_t *x, cell_t *y)
+{
+  intptr_t z;
+  if (is_fixnum(x) && is_fixnum(y)
+      && !fixnum_add_overflow(fixnum_value(x), fixnum_value(y), &z)) {
+    return mk_fixnum(z);
+  }
+  return number_op(ctx, '+', x, y);
+}
+
+static cell_t *number_sub(scheme_ctx_t *ctx, cell_t *x, cell_t *y)
+{
+  intptr_t z;
+  if (is_fixnum(x) && is_fixnum(y)
+      && !fixnum_sub_overflow(fixnum_value(x), fixnum_value(y), &z)) {
+    return mk_fixnum(z);
+  }
+  return number_op(ctx, '-', x, y);
+}
+
+static cell_t *number_mul(scheme_ctx_t *ctx, cell_t *x, cell_t *y)
+{
+  intptr_t z;
+  if (is_fixnum(x) && is_fixnum(y)
+      && !fixnum_mul_overflow(fixnum_value(x), fixnum_value(y), &z)) {
+    return mk_fixnum(z);
+  }
+  return number_op(ctx, '*', x, y);
+}
+
+/* op is '/' or '%' */
+static cell_t *number_div(scheme_ctx_t *ctx, int op, cell_t *x, cell_t *y)
+{
+  if (is_fixnum(x) && is_fixnum(y) && fixnum_value(y) != 0
+      && fixnum_value(y) != -1) {
+    return mk_fixnum(op == '/' ? fixnum_value(x) / fixnum_value(y)
+        : fixnum_value(x) % fixnum_value(y));
+  }
+  return number_op(ctx, op, x, y);
+}
+
+/* An optional sign and decimal digits, NULL for anything else. Takes 9
+ * digits at a time: r = r * 10^9 + next 9 digits. */
+static cell_t *read_integer(scheme_ctx_t *ctx, char *token)
+{
+  char *c = token + (*token == '-' || *token == '+');
+  size_t len = strlen(c);
+  if (len == 0 || strspn(c, "0123456789") != len) {
+    return NULL;
+  }
+  if (len < 2 * DECIMAL_DIGITS) {
+    /* less than 10^18 < 2^62 */
+    return mk_fixnum(strtoll(token, NULL, 10));
+  }
+  /* a decimal digit is less than 32 / 9 bits */
+  size_t size = 0;
+  uint32_t *r = digits_alloc(ctx, len / 9 + 1);
+  for (size_t pos = 0; pos < len; ) {
+    size_t step = (len - pos) % DECIMAL_DIGITS;
+    step = step ? step : DECIMAL_DIGITS;
+    uint32_t mul = 1;
+    uint64_t carry = 0;
+    for (size_t i = 0; i < step; ++i) {
+      carry = carry * 10 + (c[pos + i] - '0');
+      mul *= 10;
+    }
+    for (size_t i = 0; i < size; ++i) {
+      carry += (uint64_t)r[i] * mul;
+      r[i] = (uint32_t)carry;
+      carry >>= 32;
+    }
+    if (carry) {
+      r[size++] = (uint32_t)carry;
+    }
+    pos += step;
+  }
+  cell_t *ret = mk_bignum(ctx, r, size, *token == '-');
+  free(r);
+  return ret;
+}
+
+/* Peels off 9 decimal digits at a time by dividing by 10^9, the compiler
+ * turns that division by a constant into a multiplication. */
+static void print_bignum(scheme_ctx_t *ctx, cell_t *obj)
+{
+  bignum_t a;
+  bignum_view(obj, &a);
+  size_t size = a.size;
+  uint32_t *d = digits_alloc(ctx, size);
+  memcpy(d, a.digits, size * sizeof(uint32_t));
+  /* 2^32 < 10^(9 * 32 / 29), that many chunks at most */
+  uint32_t *chunks = digits_alloc(ctx, size * 32 / 29 + 1);
+  size_t count = 0;
+  do {
+    uint64_t r = 0;
+    for (size_t i = size; i-- > 0; ) {
+      r = (r << 32) | d[i];
+      d[i] = (uint32_t)(r / DECIMAL_BASE);
+      r %= DECIMAL_BASE;
+    }
+    chunks[count++] = (uint32_t)r;
+    size = digits_trim(d, size);
+  } while (size);
+  printf("%s%u", a.neg ? "-" : "", chunks[count - 1]);
+  while (count-- > 1) {
+    printf("%09u", chunks[count - 1]);
+  }
+  free(chunks);
+  free(d);
+}
+
+/* A decimal with a point or an exponent, or one of +inf.0, -inf.0 and
+ * +nan.0; NULL for anything else. */
+static cell_t *read_flonum(scheme_ctx_t *ctx, char *token)
+{
+  if (!strcmp(token, "+inf.0") || !strcmp(token, "-inf.0")) {
+    return mk_flonum(ctx, *token == '-' ? -INFINITY : INFINITY);
+  } else if (!strcmp(token, "+nan.0")) {
+    return mk_flonum(ctx, NAN);
+  }
+  char *rest;
+  if (strspn(token, "+-0123456789.eE") != strlen(token)
+      || !strpbrk(token, "0123456789") || !strpbrk(token, ".eE")) {
+    return NULL;
+  }
+  double value = strtod(token, &rest);
+  return *rest == '\0' ? mk_flonum(ctx, value) : NULL;
+}
+
+/* the fewest digits that read back as the same double, with a point or
+ * an exponent so they read back as a flonum. Like %g with at least 15
+ * digits, it uses the exponent form for large and small ones. */
+static void print_flonum(double value)
+{
+  char buf[40];
+  if (isnan(value)) {
+    printf("+nan.0");
+    return;
+  } else if (isinf(value)) {
+    printf(value < 0 ? "-inf.0" : "+inf.0");
+    return;
+  }
+  int digits;
+  for (digits = 1; ; ++digits) {
+    snprintf(buf, sizeof(buf), "%.*e", digits - 1, value);
+    if (digits == 17 || strtod(buf, NULL) == value) {
+      break;
+    }
+  }
+  int exponent = atoi(strchr(buf, 'e') + 1);
+  if (exponent < -4 || exponent >= (digits > 15 ? digits : 15)) {
+    printf("%s", buf);
+    return;
+  }
+  int decimals = digits - 1 - exponent;
+  snprintf(buf, sizeof(buf), "%.*f", decimals > 0 ? decimals : 0, value);
+  printf(strchr(buf, '.') ? "%s" : "%s.0", buf);
+}
+
+/* A record of 'size' slots, all (). Its cells are consecutive, the
+ * ones after the header are typed empty so the sweep leaves them to it. */
+static cell_t *mk_record(scheme_ctx_t *ctx, enum cell_type_e type, size_t size)
+{
+  cell_t *ret = get_cells(ctx, record_cells(size));
+  set_cell_type(ret, type);
+  ret->u.record.size = size;
+  for (size_t i = 1; i < record_cells(size); ++i) {
+    set_cell_type(ret + i, CELL_T_EMPTY);
+  }
+  cell_t **slots = record_slots(ret);
+  for (size_t i = 0; i < size; ++i) {
+    slots[i] = ctx->NIL;
+  }
+  return ret;
+}
+
+/* A vector is a record of its elements, u.record.length of them. As a
+ * record has to fit in half a segment, one longer than VECTOR_CHUNK is a
+ * record of vectors of VECTOR_CHUNK elements instead, the last one maybe
+ * shorter. Either way an element is two loads away at most. */
+#define VECTOR_CHUNK 4096
+#define VECTOR_MAX ((size_t)VECTOR_CHUNK * VECTOR_CHUNK)
+#define is_vector(obj) (cell_type(obj) == CELL_T_VECTOR)
+#define vector_length(v) ((v)->u.record.length)
+/* the record that holds element i */
+#define vector_chunk(v, i) (vector_length(v) <= VECTOR_CHUNK \
+    ? (v) : record_slots(v)[(i) / VECTOR_CHUNK])
+#define vector_ref(v, i) (record_slots(vector_chunk(v, i))[(i) % VECTOR_CHUNK])
+
+static void vector_set(scheme_ctx_t *ctx, cell_t *v, size_t i, cell_t *value)
+{
+  cell_t *chunk = vector_chunk(v, i);
+  cell_t **slot = &record_slots(chunk)[i % VECTOR_CHUNK];
+  gc_write_barrier(ctx, chunk, *slot, value);
+  *slot = value;
+}
+
+/* length elements, all fill; length must not be above VECTOR_MAX */
+static cell_t *mk_vector(scheme_ctx_t *ctx, size_t length, cell_t *fill)
+{
+  if (length <= VECTOR_CHUNK) {
+    cell_t *ret = mk_record(ctx, CELL_T_VECTOR, length);
+    vector_length(ret) = length;
+    for (size_t i = 0; i < length; ++i) {
+      record_slots(ret)[i] = fill;
+    }
+    return ret;
+  }
+  size_t count = (length + VECTOR_CHUNK - 1) / VECTOR_CHUNK;
+  cell_t *ret = mk_record(ctx, CELL_T_VECTOR, count);
+  vector_length(ret) = length;
+  for (size_t i = 0; i < count; ++i) {
+    cell_t *chunk = mk_vector(ctx, i < count - 1
+        ? VECTOR_CHUNK : length - i * VECTOR_CHUNK, fill);
+    /* ret may have been promoted while the chunks were allocated */
+    gc_write_barrier(ctx, ret, ctx->NIL, chunk);
+    record_slots(ret)[i] = chunk;
+  }
+  return ret;
+}
+
+static cell_t *list_to_vector(scheme_ctx_t *ctx, cell_t *list)
+{
+  size_t length = 0;
+  for (cell_t *l = list; is_pair(l); l = _cdr(l)) {
+    length += 1;
+  }
+  if (length > VECTOR_MAX) {
+    printf("ERROR: vector too long\n");
+    return ctx->NIL;
+  }
+  cell_t *ret = mk_vector(ctx, length, ctx->NIL);
+  for (size_t i = 0; i < length; ++i, list = _cdr(list)) {
+    vector_set(ctx, ret, i, _car(list));
+  }
+  return ret;
+}
+
+/* A bytevector keeps its bytes in the string heap, where they may move
+ * when it is compacted: do not hold on to u.bytevector.bytes across an
+ * allocation. */
+#define is_bytevector(obj) (cell_type(obj) == CELL_T_BYTEVECTOR)
+#define bv_bytes(obj) ((obj)->u.bytevector.bytes)
+#define bv_length(obj) ((obj)->u.bytevector.length)
+
+static cell_t *mk_bytevector(scheme_ctx_t *ctx, size_t length, int fill)
+{
+  string_reserve(ctx, length);
+  cell_t *ret = get_cell(ctx);
+  set_cell_type(ret, CELL_T_BYTEVECTOR);
+  bv_length(ret) = length;
+  bv_bytes(ret) = (uint8_t *)string_alloc(ctx, ret, NULL, length);
+  memset(bv_bytes(ret), fill, length);
+  return ret;
+}
+
+/* obj as a byte, -1 after an error if it is none */
+static int byte_value(char *name, cell_t *obj)
+{
+  if (!is_fixnum(obj) || fixnum_value(obj) < 0 || fixnum_value(obj) > 255) {
+    printf("ERROR: %s: byte expected\n", name);
+    return -1;
+  }
+  return fixnum_value(obj);
+}
+
+static cell_t *list_to_bytevector(scheme_ctx_t *ctx, cell_t *list)
+{
+  size_t length = 0;
+  for (cell_t *l = list; is_pair(l); l = _cdr(l)) {
+    if (byte_value("bytevector", _car(l)) < 0) {
+      return ctx->NIL;
+    }
+    length += 1;
+  }
+  cell_t *ret = mk_bytevector(ctx, length, 0);
+  for (size_t i = 0; i < length; ++i, list = _cdr(list)) {
+    bv_bytes(ret)[i] = fixnum_value(_car(list));
+  }
+  return ret;
+}
+
+/* A hash table is a record of the slots below. The entries are in a
+ * vector, the key of slot i at 2i and its value at 2i + 1, and a key is
+ * found by probing linearly from its hash. Growing is incremental: the
+ * entries move from HT_OLD into the new HT_ENTRIES a few slots per
+ * access, so no single access pays for copying the whole table. */
+#define HT_KIND 0     /* fixnum, enum ht_kind_e */
+#define HT_COUNT 1    /* fixnum, live entries in both vectors */
+#define HT_USED 2     /* fixnum, slots of HT_ENTRIES that are not free */
+#define HT_ENTRIES 3  /* vector of twice the capacity, a power of two */
+#define HT_OLD 4      /* vector still being moved into HT_ENTRIES, or #f */
+#define HT_MOVED 5    /* fixnum, slots of HT_OLD moved so far */
+#define HT_EPOCH 6    /* fixnum, ctx->cells_moved when the keys were hashed */
+#define HT_SIZE 7
+
+#define HT_FREE CONSTANT_UNBOUND  /* key of a slot never used */
+#define HT_MIN_CAPACITY 8
+#define HT_MOVE_STEP 16           /* slots of HT_OLD moved per access */
+#define HT_MAX_CAPACITY (VECTOR_MAX / 2)
+#define is_hashtable(obj) (cell_type(obj) == CELL_T_HASHTABLE)
+#define ht_slots(table) record_slots(table)
+#define ht_capacity(entries) (vector_length(entries) / 2)
+
+/* the equivalence the keys of a table are compared with */
+enum ht_kind_e {HT_EQ, HT_EQV, HT_STRING};
+
+static int is_eqv(cell_t *a, cell_t *b)
+{
+  if (a == b) {
+    return 1;
+  }
+  if (cell_type(a) != cell_type(b)) {
+    return 0;
+  } else if (is_flonum(a)) {
+    return !memcmp(&a->u.flonum, &b->u.flonum, sizeof(double));
+  } else if (cell_type(a) == CELL_T_BIGNUM) {
+    return !integer_cmp(a, b);
+  }
+  return 0;
+}
+
+static int ht_equal(int kind, cell_t *a, cell_t *b)
+{
+  if (kind == HT_STRING && cell_type(a) == CELL_T_STRING
+      && cell_type(b) == CELL_T_STRING) {
+    return !strcmp(a->u.string, b->u.string);
+  }
+  return kind == HT_EQ ? a == b : is_eqv(a, b);
+}
+
+/* the finalizer of splitmix64 */
+static uint32_t ht_mix(uint64_t x)
+{
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9u;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebu;
+  return (uint32_t)(x ^ (x >> 31));
+}
+
+/* Strings and numbers hash their contents, everything else its address.
+ * Cells never move, but a collector that moves them has to bump
+ * ctx->cells_moved: tables hashed before that are rehashed when they are
+ * next used (see ht_prepare()). */
+static uint32_t ht_hash(int kind, cell_t *key)
+{
+  if (kind == HT_STRING && cell_type(key) == CELL_T_STRING) {
+    return symbol_hash(key->u.string, strlen(key->u.string));
+  } else if (kind != HT_EQ && is_flonum(key)) {
+    uint64_t bits;
+    memcpy(&bits, &key->u.flonum, sizeof(bits));
+    return ht_mix(bits);
+  } else if (kind != HT_EQ && cell_type(key) == CELL_T_BIGNUM) {
+    intptr_t size = key->u.bignum.size;
+    return symbol_hash((char *)key->u.bignum.digits,
+        (size < 0 ? -size : size) * sizeof(uint32_t)) ^ (size < 0);
+  }
+  return ht_mix((uintptr_t)key);
+}
+
+/* The slot of key in entries, or the one to put it in if *found is 0: the
+ * first free one, or a deleted one before it. */
+static size_t ht_probe(int kind, cell_t *entries, cell_t *key, uint32_t hash,
+    int *found)
+{
+  size_t mask = ht_capacity(entries) - 1;
+  size_t deleted = SIZE_MAX;
+  for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+    cell_t *k = vector_ref(entries, 2 * i);
+    if (k == HT_FREE) {
+      *found = 0;
+      return deleted != SIZE_MAX ? deleted : i;
+    } else if (k == CONSTANT_DELETED) {
+      if (deleted == SIZE_MAX) {
+        deleted = i;
+      }
+    } else if (ht_equal(kind, k, key)) {
+      *found = 1;
+      return i;
+    }
+  }
+}
+
+static void ht_set_slot(scheme_ctx_t *ctx, cell_t *table, int slot,
+    cell_t *value)
+{
+  gc_write_barrier(ctx, table, ht_slots(table)[slot], value);
+  ht_slots(table)[slot] = value;
+}
+
+/* put key, which is not in HT_ENTRIES, there */
+static void ht_put(scheme_ctx_t *ctx, cell_t *table, cell_t *key,
+    cell_t *value, uint32_t hash)
+{
+  cell_t *entries = ht_slots(table)[HT_ENTRIES];
+  int found;
+  size_t i = ht_probe(fixnum_value(ht_slots(table)[HT_KIND]), entries, key,
+      hash, &found);
+  if (vector_ref(entries, 2 * i) == HT_FREE) {
+    ht_slots(table)[HT_USED] =
+      mk_fixnum(fixnum_value(ht_slots(table)[HT_USED]) + 1);
+  }
+  vector_set(ctx, entries, 2 * i, key);
+  vector_set(ctx, entries, 2 * i + 1, value);
+}
+
+static void ht_remove(scheme_ctx_t *ctx, cell_t *entries, size_t i)
+{
+  vector_set(ctx, entries, 2 * i, CONSTANT_DELETED);
+  vector_set(ctx, entries, 2 * i + 1, ctx->NIL);
+}
+
+/* move up to steps slots of HT_OLD into HT_ENTRIES */
+static void ht_move(scheme_ctx_t *ctx, cell_t *table, size_t steps)
+{
+  cell_t *old = ht_slots(table)[HT_OLD];
+  if (old == ctx->FALSE) {
+    return;
+  }
+  int kind = fixnum_value(ht_slots(table)[HT_KIND]);
+  size_t i = fixnum_value(ht_slots(table)[HT_MOVED]);
+  for (; i < ht_capacity(old) && steps; ++i, --steps) {
+    cell_t *key = vector_ref(old, 2 * i);
+    if (key != HT_FREE && key != CONSTANT_DELETED) {
+      ht_put(ctx, table, key, vector_ref(old, 2 * i + 1), ht_hash(kind, key));
+      /* lookups still probe HT_OLD past this slot */
+      ht_remove(ctx, old, i);
+    }
+  }
+  if (i == ht_capacity(old)) {
+    ht_set_slot(ctx, table, HT_OLD, ctx->FALSE);
+  } else {
+    ht_slots(table)[HT_MOVED] = mk_fixnum(i);
+  }
+}
+
+/* Start moving the entries into a new vector, twice the live entries but
+ * never smaller than the current one: then the moving is over before the
+ * new vector fills up. */
+static void ht_resize(scheme_ctx_t *ctx, cell_t *table)
+{
+  ht_move(ctx, table, SIZE_MAX);
+  cell_t *entries = ht_slots(table)[HT_ENTRIES];
+  size_t count = fixnum_value(ht_slots(table)[HT_COUNT]);
+  size_t capacity = ht_capacity(entries);
+  while (capacity < 2 * (count + 1) && capacity < HT_MAX_CAPACITY) {
+    capacity *= 2;
+  }
+  if (count + 1 > capacity * 3 / 4) {
+    scheme_error(ctx, "hash table too large");
+  }
+  cell_t *fresh = mk_vector(ctx, 2 * capacity, HT_FREE);
+  ht_set_slot(ctx, table, HT_OLD, entries);
+  ht_set_slot(ctx, table, HT_ENTRIES, fresh);
+  ht_slots(table)[HT_MOVED] = mk_fixnum(0);
+  ht_slots(table)[HT_USED] = mk_fixnum(0);
+}
+
+/* called before every access */
+static void ht_prepare(scheme_ctx_t *ctx, cell_t *table)
+{
+  if (ht_slots(table)[HT_EPOCH] != mk_fixnum(ctx->cells_moved)) {
+    /* the addresses changed, rehash everything now */
+    ht_resize(ctx, table);
+    ht_move(ctx, table, SIZE_MAX);
+    ht_slots(table)[HT_EPOCH] = mk_fixnum(ctx->cells_moved);
+  }
+  ht_move(ctx, table, HT_MOVE_STEP);
+}
+
+/* The slot of key, -1 if it is not in the table. *entries is set to the
+ * vector it is in. */
+static intptr_t ht_lookup(scheme_ctx_t *ctx, cell_t *table, cell_t *key,
+    uint32_t hash, cell_t **entries)
+{
+  int kind = fixnum_value(ht_slots(table)[HT_KIND]);
+  int found;
+  *entries = ht_slots(table)[HT_ENTRIES];
+  size_t i = ht_probe(kind, *entries, key, hash, &found);
+  if (!found && ht_slots(table)[HT_OLD] != ctx->FALSE) {
+    *entries = ht_slots(table)[HT_OLD];
+    i = ht_probe(kind, *entries, key, hash, &found);
+  }
+  return found ? (intptr_t)i : -1;
+}
+
+static cell_t *mk_hashtable(scheme_ctx_t *ctx, int kind)
+{
+  cell_t *ret = mk_record(ctx, CELL_T_HASHTABLE, HT_SIZE);
+  cell_t **slots = ht_slots(ret);
+  slots[HT_KIND] = mk_fixnum(kind);
+  slots[HT_COUNT] = mk_fixnum(0);
+  slots[HT_USED] = mk_fixnum(0);
+  slots[HT_ENTRIES] = ctx->NIL;
+  slots[HT_OLD] = ctx->FALSE;
+  slots[HT_MOVED] = mk_fixnum(0);
+  slots[HT_EPOCH] = mk_fixnum(ctx->cells_moved);
+  cell_t *entries = mk_vector(ctx, 2 * HT_MIN_CAPACITY, HT_FREE);
+  ht_set_slot(ctx, ret, HT_ENTRIES, entries);
+  return ret;
+}
+
+static cell_t *ht_ref(scheme_ctx_t *ctx, cell_t *table, cell_t *key,
+    cell_t *missing)
+{
+  cell_t *entries;
+  ht_prepare(ctx, table);
+  intptr_t i = ht_lookup(ctx, table, key,
+      ht_hash(fixnum_value(ht_slots(table)[HT_KIND]), key), &entries);
+  return i < 0 ? missing : vector_ref(entries, 2 * i + 1);
+}
+
+static void ht_set(scheme_ctx_t *ctx, cell_t *table, cell_t *key,
+    cell_t *value)
+{
+  cell_t *entries;
+  cell_t **slots = ht_slots(table);
+  ht_prepare(ctx, table);
+  uint32_t hash = ht_hash(fixnum_value(slots[HT_KIND]), key);
+  intptr_t i = ht_lookup(ctx, table, key, hash, &entries);
+  if (i >= 0 && entries == slots[HT_ENTRIES]) {
+    vector_set(ctx, entries, 2 * i + 1, value);
+    return;
+  }
+  if (i >= 0) {
+    /* not moved yet, move it now */
+    ht_remove(ctx, entries, i);
+  } else {
+    slots[HT_COUNT] = mk_fixnum(fixnum_value(slots[HT_COUNT]) + 1);
+  }
+  if ((size_t)fixnum_value(slots[HT_USED]) + 1
+      > ht_capacity(slots[HT_ENTRIES]) * 3 / 4) {
+    ht_resize(ctx, table);
+  }
+  ht_put(ctx, table, key, value, hash);
+}
+
+/* 1 if key was in the table */
+static int ht_delete(scheme_ctx_t *ctx, cell_t *table, cell_t *key)
+{
+  cell_t *entries;
+  ht_prepare(ctx, table);
+  intptr_t i = ht_lookup(ctx, table, key,
+      ht_hash(fixnum_value(ht_slots(table)[HT_KIND]), key), &entries);
+  if (i < 0) {
+    return 0;
+  }
+  ht_remove(ctx, entries, i);
+  ht_slots(table)[HT_COUNT] =
+    mk_fixnum(fixnum_value(ht_slots(table)[HT_COUNT]) - 1);
+  return 1;
+}
+
+/* A proc is the analyzed code of a lambda or macro (see resolve_proc()) */
+#define PROC_NPARAMS 0  /* fixnum, not counting the rest parameter */
+#define PROC_REST 1     /* #t if the last parameter takes the rest list */
+#define PROC_NSLOTS 2   /* fixnum, parameters plus internal defines */
+#define PROC_NAMES 3    /* list of the slot names */
+#define PROC_BODY 4
+#define PROC_CODE 5     /* bytecode of the body, () if not compiled */
+#define PROC_SIZE 6
+
+#define proc_code(fn) record_slots(record_slots((fn)->u.lambda.proc)[PROC_CODE])
+#define has_code(fn) \
+  (!is_immediate(record_slots((fn)->u.lambda.proc)[PROC_CODE]))
+
+/* A frame holds the local variables of one lambda call */
+#define FRAME_PARENT 0  /* frame the lambda was created in, or () */
+#define FRAME_NAMES 1   /* PROC_NAMES of the lambda */
+#define FRAME_SLOTS 2
+
+/* closure over the running frame */
+cell_t *mk_lambda(scheme_ctx_t *ctx, cell_t *proc)
+{
+  cell_t *ret = get_cell(ctx);
+  set_cell_type(ret, CELL_T_LAMBDA);
+  ret->u.lambda.proc = proc;
+  ret->u.lambda.env = ctx->frame;
+  if (!is_null(ctx, ctx->frame)) {
+    ctx->frame->u.record.captured = 1;
+  }
+  return ret;
+}
+
+cell_t *mk_macro(scheme_ctx_t *ctx, cell_t *proc)
+{
+  cell_t *ret = mk_lambda(ctx, proc);
+  set_cell_type(ret, CELL_T_MACRO);
+  return ret;
+}
+
+
+/* --- obj --- */
+
+cell_t *mk_object_from_token(scheme_ctx_t *ctx, char *token)
+{
+  cell_t *ret = ctx->NIL;
+  char *c;
+  switch(*token) {
+    case '"':
+      if ((c = strchr(token+1, '"'))) {
+        *c = '\0';
+      }
+      ret = mk_string(ctx, token+1);
+      break;
+    default:
+      ret = read_integer(ctx, token);
+      if (!ret) {
+        ret = read_flonum(ctx, token);
+      }
+      if (!ret) {
+        ret = mk_symbol(ctx, token);
+      }
+      break;
+  }
+  return ret;
+}
+
+cell_t *get_object(scheme_ctx_t *ctx);
+cell_t *get_obj_list(scheme_ctx_t *ctx)
+{
+  /* a loop, long lists must not use up the C stack */
+  cell_t *head = ctx->NIL;
+  cell_t *last = NULL;
+  for (;;) {
+    cell_t *obj = get_object(ctx);
+    cell_t *rest;
+    if (!obj) {
+      /* EOF reached */
+      printf("missing ')' at end of input\n");
+      exit(1);
+    }
+    if (obj == ctx->PARENTHESIS_CLOSE) {
+      return head;
+    }
+    if (obj == ctx->SYMBOL_DOT) {
+      rest = get_object(ctx);
+      if (ctx->PARENTHESIS_CLOSE == rest) {
+        /* error */
+        printf("unexpected ')'\n");
+        rest = ctx->NIL;
+      } else if (ctx->PARENTHESIS_CLOSE != get_object(ctx)) {
+        printf("expect ')'!\n");
+        rest = ctx->NIL;
+      }
+    } else {
+      rest = cons(ctx, obj, ctx->NIL);
+    }
+    if (last) {
+      gc_write_barrier(ctx, last, _cdr(last), rest);
+      _cdr(last) = rest;
+    } else {
+      head = rest;
+    }
+    if (obj == ctx->SYMBOL_DOT) {
+      return head;
+    }
+    last = rest;
+  }
+}
+
+cell_t *get_object(scheme_ctx_t *ctx)
+{
+  char *value = tokenizer_get_token(&ctx->tokenizer_ctx);
+  if (!value) {
+    return NULL; /* eof */
+  }
+  cell_t *obj = mk_object_from_token(ctx, value);
+  if (obj == ctx->SYMBOL_QUOTE_ALIAS) {
+    return cons(ctx, ctx->SYMBOL_QUOTE, cons(ctx, get_object(ctx), ctx->NIL));
+  } else if (obj == ctx->SYMBOL_QUASIQUOTE_ALIAS) {
+    return cons(ctx, ctx->SYMBOL_QUASIQUOTE, get_object(ctx));
+  } else if (obj == ctx->SYMBOL_UNQUOTE_ALIAS) {
+    return cons(ctx, ctx->SYMBOL_UNQUOTE, cons(ctx, get_object(ctx), ctx->NIL));
+  } else if (obj == ctx->PARENTHESIS_OPEN) {
+    return get_obj_list(ctx);
+  } else if (obj == ctx->VECTOR_OPEN) {
+    return list_to_vector(ctx, get_obj_list(ctx));
+  } else if (obj == ctx->BYTEVECTOR_PREFIX) {
+    return list_to_bytevector(ctx, get_object(ctx));
+  } else if (obj == ctx->SYMBOL_UNQUOTE_SPLICE_ALIAS) {
+    return cons(ctx, ctx->SYMBOL_UNQUOTE_SPLICE, cons(ctx, get_object(ctx), ctx->NIL));
+  }
+  return obj;
+}
+
+/*------------------------ print -------------------- */
+
+void print_obj(scheme_ctx_t *ctx, cell_t *obj);
+void print_pair(scheme_ctx_t *ctx, cell_t *pair)
+{
+  printf("(");
+  while (is_pair(pair)) {
+    print_obj(ctx, _car(pair));
+    pair = _cdr(pair);
+    if (is_pair(pair)) {
+      printf(" ");
+    }
+  }
+  if (!is_null(ctx, pair)) {
+    printf(". ");
+    print_obj(ctx, pair);
+  }
+  printf(")");
+}
+
+void print_obj(scheme_ctx_t *ctx, cell_t *obj) {
+  check_c_stack(ctx);
+  switch (cell_type(obj)) {
+    case CELL_T_PRIMOP:
+      printf("<primop>");
+      break;
+    case CELL_T_SYMBOL:
+      printf("%s", obj->u.symbol.name);
+      break;
+    case CELL_T_STRING:
+      printf("\"%s\"", obj->u.string);
+      break;
+    case CELL_T_PAIR:
+      print_pair(ctx, obj);
+      break;
+    case CELL_T_INTEGER:
+      printf("%ld", (long)fixnum_value(obj));
+      break;
+    case CELL_T_BIGNUM:
+      print_bignum(ctx, obj);
+      break;
+    case CELL_T_FLONUM:
+      print_flonum(obj->u.flonum);
+      break;
+    case CELL_T_LAMBDA:
+      printf("<lambda>");
+      break;
+    case CELL_T_MACRO:
+      printf("<macro>");
+      break;
+    case CELL_T_FRAME:
+      printf("<frame>");
+      break;
+    case CELL_T_PROC:
+      printf("<proc>");
+      break;
+    case CELL_T_NODE:
+      printf("<node>");
+      break;
+    case CELL_T_CODE:
+      printf("<code>");
+      break;
+    case CELL_T_VECTOR:
+      printf("#(");
+      for (size_t i = 0; i < vector_length(obj); ++i) {
+        if (i) {
+          printf(" ");
+        }
+        print_obj(ctx, vector_ref(obj, i));
+      }
+      printf(")");
+      break;
+    case CELL_T_HASHTABLE:
+      printf("<hash-table>");
+      break;
+    case CELL_T_BYTEVECTOR:
+      printf("#u8(");
+      for (size_t i = 0; i < bv_length(obj); ++i) {
+        printf(i ? " %u" : "%u", bv_bytes(obj)[i]);
+      }
+      printf(")");
+      break;
+    default:
+      if (is_null(ctx, obj)) {
+        printf("()");
+      } else if (is_true(ctx, obj)) {
+        printf("#t");
+      } else if (is_false(ctx, obj)) {
+        printf("#f");
+      } else {
+        printf("<unknown>");
+      }
+      break;
+  }
+}
+
+static char *get_type_name(int type)
+{
+  return cell_type_names[type];
+}
+
+int list_length(cell_t *args)
+{
+  int ret = 0;
+  while (is_pair(args)) {
+    ++ret;
+    args = _cdr(args);
+  }
+  return ret;
+}
+
+
+static int get_args(cell_t *args, int nr, int types[], cell_t *ret[])
+{
+  int i = 0;
+  while (i < nr) {
+    if (!is_pair(args)) {
+      printf("ERROR: missing argument, expected %d given %d\n", nr, i);
+      return -1;
+    }
+    cell_t *obj = _car(args);
+    if (cell_type(obj) != types[i]) {
+      if (types[i] != CELL_T_EMPTY) {
+        printf("ERROR: %s expected %s given\n",
+            get_type_name(types[i]), get_type_name(cell_type(obj)));
+        return -1;
+      }
+    }
+    ret[i] = obj;
+    args = _cdr(args);
+    ++i;
+  }
+  int to_many_args = 0;
+  while (is_pair(args)) {
+    ++to_many_args;
     args = _cdr(args);
   }
-  return ret;
+  if (to_many_args) {
+    printf("ERROR: to many arguments %d expected %d given\n",
+        nr, nr + to_many_args);
+    return -1;
+  }
+  return 0;
+}
+
+cell_t *car(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  return _car(args[0]);
+}
+
+cell_t *cdr(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  return _cdr(args[0]);
+}
+
+cell_t *set_car(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  gc_write_barrier(ctx, args[0], _car(args[0]), args[1]);
+  _car(args[0]) = args[1];
+  return ctx->NIL;
+}
+
+cell_t *set_cdr(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  gc_write_barrier(ctx, args[0], _cdr(args[0]), args[1]);
+  _cdr(args[0]) = args[1];
+  return ctx->NIL;
+}
+
+cell_t *op_minus(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  if (n == 1) {
+    return number_sub(ctx, mk_fixnum(0), args[0]);
+  }
+  cell_t *ret = args[0];
+  for (int i = 1; i < n; ++i) {
+    ret = number_sub(ctx, ret, args[i]);
+  }
+  return ret;
+}
+
+cell_t *op_plus(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  cell_t *ret = mk_fixnum(0);
+  for (int i = 0; i < n; ++i) {
+    ret = number_add(ctx, ret, args[i]);
+  }
+  return ret;
+}
+
+cell_t *op_mul(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  cell_t *ret = mk_fixnum(1);
+  for (int i = 0; i < n; ++i) {
+    ret = number_mul(ctx, ret, args[i]);
+  }
+  return ret;
+}
+
+cell_t *op_div(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  if (n == 1) {
+    return number_div(ctx, '/', mk_fixnum(1), args[0]);
+  }
+  cell_t *ret = args[0];
+  for (int i = 1; i < n && !is_null(ctx, ret); ++i) {
+    ret = number_div(ctx, '/', ret, args[i]);
+  }
+  return ret;
+}
+
+cell_t *op_gt(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  return number_compare(args[0], args[1], >) ? ctx->TRUE : ctx->FALSE;
+}
+
+cell_t *op_gt_eq(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  return number_compare(args[0], args[1], >=) ? ctx->TRUE : ctx->FALSE;
+}
+
+cell_t *op_lt(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  return number_compare(args[0], args[1], <) ? ctx->TRUE : ctx->FALSE;
+}
+
+cell_t *op_lt_eq(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  return number_compare(args[0], args[1], <=) ? ctx->TRUE : ctx->FALSE;
+}
+
+/* the fl primops take flonums only, so the optimizer knows they give one
+ * (see node_flonum()) */
+cell_t *fl_add(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  double ret = 0;
+  for (int i = 0; i < n; ++i) {
+    ret += args[i]->u.flonum;
+  }
+  return mk_flonum(ctx, ret);
+}
+
+cell_t *fl_sub(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  double ret = n == 1 ? 0 : args[0]->u.flonum;
+  for (int i = n == 1 ? 0 : 1; i < n; ++i) {
+    ret -= args[i]->u.flonum;
+  }
+  return mk_flonum(ctx, ret);
+}
+
+cell_t *fl_mul(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  double ret = 1;
+  for (int i = 0; i < n; ++i) {
+    ret *= args[i]->u.flonum;
+  }
+  return mk_flonum(ctx, ret);
+}
+
+cell_t *fl_div(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  double ret = n == 1 ? 1 : args[0]->u.flonum;
+  for (int i = n == 1 ? 0 : 1; i < n; ++i) {
+    ret /= args[i]->u.flonum;
+  }
+  return mk_flonum(ctx, ret);
+}
+
+cell_t *fl_eq(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  return args[0]->u.flonum == args[1]->u.flonum ? ctx->TRUE : ctx->FALSE;
+}
+
+cell_t *fl_lt(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  return args[0]->u.flonum < args[1]->u.flonum ? ctx->TRUE : ctx->FALSE;
+}
+
+cell_t *fl_gt(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  return args[0]->u.flonum > args[1]->u.flonum ? ctx->TRUE : ctx->FALSE;
+}
+
+cell_t *fl_lt_eq(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  return args[0]->u.flonum <= args[1]->u.flonum ? ctx->TRUE : ctx->FALSE;
+}
+
+cell_t *fl_gt_eq(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  return args[0]->u.flonum >= args[1]->u.flonum ? ctx->TRUE : ctx->FALSE;
+}
+
+cell_t *inexact(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  return is_flonum(args[0]) ? args[0]
+      : mk_flonum(ctx, number_to_double(args[0]));
+}
+
+/* there are no rationals, a flonum loses its fraction */
+cell_t *exact(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  return is_flonum(args[0]) ? double_to_integer(ctx, args[0]->u.flonum)
+      : args[0];
+}
+
+cell_t *write_primop(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  print_obj(ctx, args[0]);
+  return ctx->NIL;
+}
+
+cell_t *display(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  if (cell_type(args[0]) == CELL_T_STRING) {
+    printf("%s", args[0]->u.string);
+  } else {
+    print_obj(ctx, args[0]);
+  }
+  return ctx->NIL;
+}
+
+cell_t *newline(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  printf("\n");
+  return ctx->NIL;
+}
+
+cell_t *flush_output(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  /* ignore args for now */
+  fflush(stdout);
+  return ctx->NIL;
+}
+
+cell_t *gc_info_primop(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  gc_info(ctx);
+  return ctx->NIL;
+}
+
+/* a monotonic clock in microseconds, for timing code */
+cell_t *current_jiffy(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  return mk_uint64(ctx, gc_clock() / 1000);
+}
+
+cell_t *jiffies_per_second(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  return mk_fixnum(1000000);
+}
+
+cell_t *eq(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  return (args[0] == args[1]) ? ctx->TRUE : ctx->FALSE;
+}
+
+cell_t *string_eq(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  return !strcmp(args[0]->u.string, args[1]->u.string)
+    ? ctx->TRUE : ctx->FALSE;
+}
+
+cell_t *integer_eq(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  return number_compare(args[0], args[1], ==) ? ctx->TRUE : ctx->FALSE;
+}
+
+cell_t *modulo(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  return number_div(ctx, '%', args[0], args[1]);
+}
+
+/* eq? but numbers of the same exactness and value are the same too */
+cell_t *eqv(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  return is_eqv(args[0], args[1]) ? ctx->TRUE : ctx->FALSE;
+}
+
+/* call a primop with n arguments, args usually points into the root
+ * stack */
+cell_t *apply_primop(scheme_ctx_t *ctx, cell_t *primop, cell_t **args, int n)
+{
+  const primop_t *p = primop->u.primop;
+  if (n < p->min_args) {
+    printf("ERROR: missing argument, expected %d given %d\n", p->min_args, n);
+    return ctx->NIL;
+  }
+  if (p->max_args != PRIMOP_VARIADIC && n > p->max_args) {
+    printf("ERROR: to many arguments %d expected %d given\n", p->max_args, n);
+    return ctx->NIL;
+  }
+  int typed = p->rest_type != CELL_T_EMPTY ? n
+      : n < PRIMOP_TYPED ? n : PRIMOP_TYPED;
+  for (int i = 0; i < typed; ++i) {
+    int type = i < PRIMOP_TYPED ? p->types[i] : p->rest_type;
+    int given = cell_type(args[i]);
+    if (given == CELL_T_BIGNUM) {
+      given = CELL_T_INTEGER;  /* integer covers both representations */
+    }
+    if (type != CELL_T_EMPTY && given != type
+        && !(type == CELL_T_NUMBER && is_number(args[i]))) {
+      printf("ERROR: %s expected %s given\n",
+          get_type_name(type), get_type_name(given));
+      return ctx->NIL;
+    }
+  }
+  return p->fn(ctx, args, n);
+}
+
+cell_t *primop_length(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  return mk_integer(ctx, list_length(args[0]));
+}
+
+cell_t *primop_cons(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  return cons(ctx, args[0], args[1]);
+}
+
+/* environment hanlding */
+
+/* The value of a global variable is kept in its symbol, so code refers
+ * to a global through the symbol cell and reads it with one load; a
+ * redefinition is seen by every caller at once. Variables bound by a
+ * lambda are found by analyze() before the code runs and are read from
+ * their position in the chain of frames (see frame_up()). */
+
+cell_t *env_define(scheme_ctx_t *ctx, cell_t *symbol, cell_t *value)
+{
+  if (is_primop(symbol->u.symbol.value) && symbol->u.symbol.value != value) {
+    /* constants folded from calls to it are no longer valid */
+    ++ctx->builtin_epoch;
+  }
+  gc_write_barrier(ctx, symbol, symbol->u.symbol.value, value);
+  symbol->u.symbol.value = value;
+  return value;
+}
+
+static cell_t *env_lookup(scheme_ctx_t *ctx, cell_t *symbol)
+{
+  cell_t *value = symbol->u.symbol.value;
+  return value == CONSTANT_UNBOUND ? NULL : value;
+}
+
+cell_t *env_resolve(scheme_ctx_t *ctx, cell_t *symbol)
+{
+  cell_t *ret = env_lookup(ctx, symbol);
+  if (!ret) {
+    printf("ERROR: symbol '%s' is not defined\n", symbol->u.symbol.name);
+    return ctx->NIL; /* symbol not found in environment */
+  }
+  return ret;
+}
+
+static cell_t *frame_up(scheme_ctx_t *ctx, int depth)
+{
+  cell_t *frame = ctx->frame;
+  while (depth--) {
+    frame = record_slots(frame)[FRAME_PARENT];
+  }
+  return frame;
+}
+
+static cell_t *local_set(scheme_ctx_t *ctx, int depth, int index,
+    cell_t *value)
+{
+  cell_t *frame = frame_up(ctx, depth);
+  cell_t **slot = record_slots(frame) + FRAME_SLOTS + index;
+  gc_write_barrier(ctx, frame, *slot, value);
+  *slot = value;
+  return value;
+}
+
+/* eval */
+
+/* Runs a node made by analyze(). Like every evaluation it leaves the
+ * result on the root stack and drops the temporaries of the node. */
+static cell_t *eval_node(scheme_ctx_t *ctx, cell_t *node, tail_t *tail)
+{
+  size_t old_roots_pos = ctx->roots_pos;
+  cell_t *ret = node->u.record.exec(ctx, node, tail);
+  ctx->roots_pos = old_roots_pos;
+  return push_root(ctx, ret);
+}
+
+cell_t *eval(scheme_ctx_t *ctx, cell_t *node)
+{
+  return eval_node(ctx, node, NULL);
+}
+
+cell_t *eval_list(scheme_ctx_t *ctx, cell_t *list)
+{
+  if (ctx->NIL == list) {
+    return ctx->NIL;
+  }
+  /* eval() leaves its result on the root stack */
+  cell_t *obj = eval(ctx, _car(list));
+  return cons(ctx, obj, eval_list(ctx, _cdr(list)));
+}
+
+cell_t *eval_quasiquote(scheme_ctx_t *ctx, cell_t *list)
+{
+  if (!is_pair(list)) {
+    return list;
+  }
+  cell_t *obj;
+  if (ctx->SYMBOL_UNQUOTE == _car(list)) {
+    return eval (ctx, _car(_cdr(list)));
+  } else if (is_pair(_car(list))) {
+      if (ctx->SYMBOL_UNQUOTE == _car(_car(list))) {
+        obj = eval(ctx, _car(_cdr(_car(list))));
+      } else if (ctx->SYMBOL_UNQUOTE_SPLICE == _car(_car(list))) {
+        obj = eval_list(ctx, _cdr(_car(list)));
+        return _car(obj);
+      } else {
+        obj = eval_quasiquote(ctx, _car(list));
+      }
+  } else {
+    obj = _car(list);
+  }
+  return (cons(ctx, push_root(ctx, obj), eval_quasiquote(ctx, _cdr(list))));
+}
+
+/* the frame for calling lambda with the n arguments on the root stack
+ * from position base on, NULL if they do not match its parameters */
+static cell_t *lambda_frame(scheme_ctx_t *ctx, cell_t *lambda, size_t base,
+    int n)
+{
+  cell_t **proc = record_slots(lambda->u.lambda.proc);
+  int nparams = fixnum_value(proc[PROC_NPARAMS]);
+  int rest = is_true(ctx, proc[PROC_REST]);
+  if (n < nparams || (n > nparams && !rest)) {
+    printf("ERROR: wrong number of arguments, expected %d given %d\n",
+        nparams, n);
+    return NULL;
+  }
+  cell_t *list = ctx->NIL;
+  for (int i = n - 1; i >= nparams; --i) {
+    list = cons(ctx, ctx->roots[base + i], list);
+  }
+  cell_t *frame = mk_record(ctx, CELL_T_FRAME,
+      FRAME_SLOTS + fixnum_value(proc[PROC_NSLOTS]));
+  frame->u.record.captured = 0;
+  cell_t **slots = record_slots(frame);
+  slots[FRAME_PARENT] = lambda->u.lambda.env;
+  slots[FRAME_NAMES] = proc[PROC_NAMES];
+  for (int i = 0; i < nparams; ++i) {
+    slots[FRAME_SLOTS + i] = ctx->roots[base + i];
+  }
+  if (rest) {
+    slots[FRAME_SLOTS + nparams] = list;
+  }
+  return frame;
+}
+
+static cell_t *vm_run(scheme_ctx_t *ctx, cell_t *lambda, cell_t *frame,
+    tail_t *tail);
+
+/* count a call, raise an error when there are too many in progress */
+#define enter_call(ctx) do { \
+    if (++(ctx)->depth > (ctx)->depth_high) { \
+      (ctx)->depth_high = (ctx)->depth; \
+      if ((ctx)->depth > (ctx)->max_depth) { \
+        scheme_error(ctx, "maximum call depth exceeded"); \
+      } \
+    } \
+  } while (0)
+
+static void check_c_stack(scheme_ctx_t *ctx)
+{
+  char here;
+  size_t used = &here < ctx->c_stack_base
+      ? (size_t)(ctx->c_stack_base - &here)
+      : (size_t)(&here - ctx->c_stack_base);
+  if (used > ctx->c_stack_limit) {
+    scheme_error(ctx, "nested too deeply for the C stack");
+  }
+}
+
+static cell_t *run_lambda(scheme_ctx_t *ctx, cell_t *lambda, cell_t *frame)
+{
+  check_c_stack(ctx);
+  enter_call(ctx);
+  cell_t *caller_frame = push_root(ctx, ctx->frame);
+  size_t old_roots_pos = ctx->roots_pos;
+  tail_t tail = {lambda, frame};
+  cell_t *ret;
+
+  do {
+    /* TAIL CALLS: go again with the lambda called last and its frame */
+    frame = tail.frame;
+    tail.frame = NULL;
+    push_root(ctx, tail.lambda);
+    if (has_code(tail.lambda)) {
+      ret = vm_run(ctx, tail.lambda, frame, &tail);
+    } else {
+      ctx->frame = frame;
+      ret = eval_node(ctx,
+          record_slots(tail.lambda->u.lambda.proc)[PROC_BODY], &tail);
+    }
+    ctx->roots_pos = old_roots_pos;
+  } while (tail.frame);
+  ctx->frame = caller_frame;
+  --ctx->depth;
+  return ret;
+}
+
+/* call the macro with the whole form, returns the expansion */
+static cell_t *macro_expand(scheme_ctx_t *ctx, cell_t *macro, cell_t *form)
+{
+  size_t base = ctx->roots_pos;
+  push_root(ctx, form);
+  cell_t *frame = lambda_frame(ctx, macro, base, 1);
+  if (!frame) {
+    return ctx->NIL;
+  }
+  return push_root(ctx, run_lambda(ctx, macro, frame));
+}
+
+cell_t *apply(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  cell_t *list = n > 1 ? args[1] : ctx->NIL;
+  if (!is_null(ctx, list) && !is_pair(list)) {
+    printf("ERROR: apply: argument 1 must be pair (or null)\n");
+    return ctx->NIL;
+  }
+  if (!is_primop(args[0]) && !is_lambda(args[0])) {
+    printf("ERROR: apply: cannot apply\n");
+    return ctx->NIL;
+  }
+  size_t base = ctx->roots_pos;
+  int count = 0;
+  for (; is_pair(list); list = _cdr(list), ++count) {
+    push_root(ctx, _car(list));
+  }
+  if (is_primop(args[0])) {
+    return apply_primop(ctx, args[0], &ctx->roots[base], count);
+  }
+  cell_t *frame = lambda_frame(ctx, args[0], base, count);
+  return frame ? run_lambda(ctx, args[0], frame) : ctx->NIL;
+}
+
+/* vectors */
+
+/* obj as an index below bound, -1 after an error if it is none */
+static intptr_t index_arg(char *name, cell_t *obj, size_t bound)
+{
+  if (!is_fixnum(obj) || fixnum_value(obj) < 0
+      || (size_t)fixnum_value(obj) >= bound) {
+    printf("ERROR: %s: index out of range\n", name);
+    return -1;
+  }
+  return fixnum_value(obj);
+}
+
+/* the optional start and end arguments from args[first] on into a
+ * sequence of length elements, 0 and length if they are missing */
+static int range_args(char *name, cell_t **args, int n, int first,
+    size_t length, size_t *start, size_t *end)
+{
+  intptr_t from = n > first ? index_arg(name, args[first], length + 1) : 0;
+  intptr_t to = n > first + 1
+      ? index_arg(name, args[first + 1], length + 1) : (intptr_t)length;
+  if (from < 0 || to < 0) {
+    return -1;
+  }
+  if (from > to) {
+    printf("ERROR: %s: start after end\n", name);
+    return -1;
+  }
+  *start = from;
+  *end = to;
+  return 0;
+}
+
+cell_t *make_vector(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  if (!is_fixnum(args[0]) || fixnum_value(args[0]) < 0
+      || (size_t)fixnum_value(args[0]) > VECTOR_MAX) {
+    printf("ERROR: make-vector: bad length\n");
+    return ctx->NIL;
+  }
+  return mk_vector(ctx, fixnum_value(args[0]), n > 1 ? args[1] : ctx->FALSE);
+}
+
+cell_t *vector(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  cell_t *ret = mk_vector(ctx, n, ctx->NIL);
+  for (int i = 0; i < n; ++i) {
+    vector_set(ctx, ret, i, args[i]);
+  }
+  return ret;
+}
+
+cell_t *vector_length_primop(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  return mk_integer(ctx, vector_length(args[0]));
+}
+
+cell_t *vector_ref_primop(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  intptr_t i = index_arg("vector-ref", args[1], vector_length(args[0]));
+  return i < 0 ? ctx->NIL : vector_ref(args[0], i);
+}
+
+cell_t *vector_set_primop(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  intptr_t i = index_arg("vector-set!", args[1], vector_length(args[0]));
+  if (i >= 0) {
+    vector_set(ctx, args[0], i, args[2]);
+  }
+  return ctx->NIL;
+}
+
+cell_t *vector_fill(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  size_t start, end;
+  if (!range_args("vector-fill!", args, n, 2, vector_length(args[0]),
+        &start, &end)) {
+    for (size_t i = start; i < end; ++i) {
+      vector_set(ctx, args[0], i, args[1]);
+    }
+  }
+  return ctx->NIL;
+}
+
+cell_t *vector_copy(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  size_t start, end;
+  if (range_args("vector-copy", args, n, 1, vector_length(args[0]),
+        &start, &end)) {
+    return ctx->NIL;
+  }
+  cell_t *ret = mk_vector(ctx, end - start, ctx->NIL);
+  for (size_t i = start; i < end; ++i) {
+    vector_set(ctx, ret, i - start, vector_ref(args[0], i));
+  }
+  return ret;
+}
+
+/* (vector-map f v ...) calls f with the elements at each index, up to the
+ * end of the shortest vector */
+cell_t *vector_map(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  if (!is_primop(args[0]) && !is_lambda(args[0])) {
+    printf("ERROR: vector-map: cannot apply\n");
+    return ctx->NIL;
+  }
+  size_t length = vector_length(args[1]);
+  for (int j = 2; j < n; ++j) {
+    if (vector_length(args[j]) < length) {
+      length = vector_length(args[j]);
+    }
+  }
+  cell_t *ret = mk_vector(ctx, length, ctx->NIL);
+  size_t base = ctx->roots_pos;
+  for (size_t i = 0; i < length; ++i) {
+    for (int j = 1; j < n; ++j) {
+      push_root(ctx, vector_ref(args[j], i));
+    }
+    cell_t *value;
+    if (is_primop(args[0])) {
+      value = apply_primop(ctx, args[0], &ctx->roots[base], n - 1);
+    } else {
+      cell_t *frame = lambda_frame(ctx, args[0], base, n - 1);
+      value = frame ? run_lambda(ctx, args[0], frame) : ctx->NIL;
+    }
+    ctx->roots_pos = base;
+    vector_set(ctx, ret, i, value);
+  }
+  return ret;
+}
+
+cell_t *vector_to_list(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  cell_t *ret = ctx->NIL;
+  for (size_t i = vector_length(args[0]); i-- > 0; ) {
+    ret = cons(ctx, vector_ref(args[0], i), ret);
+  }
+  return ret;
+}
+
+cell_t *list_to_vector_primop(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  return list_to_vector(ctx, args[0]);
+}
+
+/* bytevectors, the bulk operations run the kernels in bytes.c */
+
+cell_t *make_bytevector(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  int fill = n > 1 ? byte_value("make-bytevector", args[1]) : 0;
+  if (!is_fixnum(args[0]) || fixnum_value(args[0]) < 0) {
+    printf("ERROR: make-bytevector: bad length\n");
+    return ctx->NIL;
+  }
+  return fill < 0 ? ctx->NIL : mk_bytevector(ctx, fixnum_value(args[0]), fill);
+}
+
+cell_t *bytevector(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  for (int i = 0; i < n; ++i) {
+    if (byte_value("bytevector", args[i]) < 0) {
+      return ctx->NIL;
+    }
+  }
+  cell_t *ret = mk_bytevector(ctx, n, 0);
+  for (int i = 0; i < n; ++i) {
+    bv_bytes(ret)[i] = fixnum_value(args[i]);
+  }
+  return ret;
+}
+
+cell_t *bytevector_length(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  return mk_integer(ctx, bv_length(args[0]));
+}
+
+cell_t *bytevector_ref(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  intptr_t i = index_arg("bytevector-u8-ref", args[1], bv_length(args[0]));
+  return i < 0 ? ctx->NIL : mk_fixnum(bv_bytes(args[0])[i]);
+}
+
+cell_t *bytevector_set(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  intptr_t i = index_arg("bytevector-u8-set!", args[1], bv_length(args[0]));
+  int byte = byte_value("bytevector-u8-set!", args[2]);
+  if (i >= 0 && byte >= 0) {
+    bv_bytes(args[0])[i] = byte;
+  }
+  return ctx->NIL;
+}
+
+cell_t *bytevector_copy(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  size_t start, end;
+  if (range_args("bytevector-copy", args, n, 1, bv_length(args[0]),
+        &start, &end)) {
+    return ctx->NIL;
+  }
+  cell_t *ret = mk_bytevector(ctx, end - start, 0);
+  memcpy(bv_bytes(ret), bv_bytes(args[0]) + start, end - start);
+  return ret;
+}
+
+/* (bytevector-copy! to at from [start [end]]), the two may overlap */
+cell_t *bytevector_copy_to(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  size_t start, end;
+  if (!is_bytevector(args[2])) {
+    printf("ERROR: bytevector-copy!: bytevector expected\n");
+    return ctx->NIL;
+  }
+  intptr_t at = index_arg("bytevector-copy!", args[1], bv_length(args[0]) + 1);
+  if (at < 0 || range_args("bytevector-copy!", args + 2, n - 2, 1,
+        bv_length(args[2]), &start, &end)) {
+    return ctx->NIL;
+  }
+  if (end - start > bv_length(args[0]) - at) {
+    printf("ERROR: bytevector-copy!: too many bytes\n");
+    return ctx->NIL;
+  }
+  memmove(bv_bytes(args[0]) + at, bv_bytes(args[2]) + start, end - start);
+  return ctx->NIL;
+}
+
+cell_t *bytevector_fill(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  size_t start, end;
+  int byte = byte_value("bytevector-fill!", args[1]);
+  if (byte >= 0 && !range_args("bytevector-fill!", args, n, 2,
+        bv_length(args[0]), &start, &end)) {
+    memset(bv_bytes(args[0]) + start, byte, end - start);
+  }
+  return ctx->NIL;
+}
+
+/* -1, 0 or 1 as a sorts before, with or after b, bytewise */
+cell_t *bytevector_compare(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  size_t la = bv_length(args[0]);
+  size_t lb = bv_length(args[1]);
+  int cmp = memcmp(bv_bytes(args[0]), bv_bytes(args[1]), la < lb ? la : lb);
+  if (!cmp) {
+    cmp = (la > lb) - (la < lb);
+  }
+  return mk_fixnum((cmp > 0) - (cmp < 0));
+}
+
+cell_t *bytevector_equal(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  return bv_length(args[0]) == bv_length(args[1])
+      && !memcmp(bv_bytes(args[0]), bv_bytes(args[1]), bv_length(args[0]))
+      ? ctx->TRUE : ctx->FALSE;
+}
+
+/* (bytevector-index bv pattern [start]) where pattern is a byte or a
+ * bytevector: the index of its first occurrence from start on, or #f */
+cell_t *bytevector_index(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  size_t start, end;
+  uint8_t byte;
+  const uint8_t *pattern = &byte;
+  size_t m = 1;
+  if (is_bytevector(args[1])) {
+    pattern = bv_bytes(args[1]);
+    m = bv_length(args[1]);
+  } else if (byte_value("bytevector-index", args[1]) < 0) {
+    return ctx->NIL;
+  } else {
+    byte = fixnum_value(args[1]);
+  }
+  if (range_args("bytevector-index", args, n, 2, bv_length(args[0]),
+        &start, &end)) {
+    return ctx->NIL;
+  }
+  size_t i = bytes_find(bv_bytes(args[0]) + start, end - start, pattern, m);
+  return i == (size_t)-1 ? ctx->FALSE : mk_fixnum(start + i);
+}
+
+cell_t *bytevector_sum(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  size_t start, end;
+  if (range_args("bytevector-sum", args, n, 1, bv_length(args[0]),
+        &start, &end)) {
+    return ctx->NIL;
+  }
+  return mk_uint64(ctx, bytes_sum(bv_bytes(args[0]) + start, end - start));
+}
+
+/* (bytevector-xor! to from) xors from into the start of to */
+cell_t *bytevector_xor(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  if (bv_length(args[1]) > bv_length(args[0])) {
+    printf("ERROR: bytevector-xor!: source longer than target\n");
+    return ctx->NIL;
+  }
+  bytes_xor(bv_bytes(args[0]), bv_bytes(args[1]), bv_length(args[1]));
+  return ctx->NIL;
+}
+
+/* the Adler-32 checksum, as zlib computes it */
+cell_t *bytevector_adler32(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  size_t start, end;
+  if (range_args("bytevector-adler32", args, n, 1, bv_length(args[0]),
+        &start, &end)) {
+    return ctx->NIL;
+  }
+  return mk_uint64(ctx,
+      bytes_adler32(1, bv_bytes(args[0]) + start, end - start));
+}
+
+cell_t *bytevector_to_list(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  cell_t *ret = ctx->NIL;
+  for (size_t i = bv_length(args[0]); i-- > 0; ) {
+    /* cons() may compact the string heap, reload the bytes */
+    ret = cons(ctx, mk_fixnum(bv_bytes(args[0])[i]), ret);
+  }
+  return ret;
+}
+
+cell_t *list_to_bytevector_primop(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  return list_to_bytevector(ctx, args[0]);
+}
+
+/* hash tables */
+
+static cell_t *apply_values(scheme_ctx_t *ctx, cell_t *fn, size_t base, int n,
+    cell_t *source);
+
+/* (make-hash-table [equal]) where equal is eq?, eqv? (the default) or
+ * string=?, which compares strings by their characters and anything else
+ * with eqv? */
+cell_t *make_hash_table(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  int kind = HT_EQV;
+  if (n > 0) {
+    primop_fn fn = is_primop(args[0]) ? args[0]->u.primop->fn : NULL;
+    if (fn == &eq) {
+      kind = HT_EQ;
+    } else if (fn == &string_eq) {
+      kind = HT_STRING;
+    } else if (fn != &eqv) {
+      printf("ERROR: make-hash-table: eq?, eqv? or string=? expected\n");
+      return ctx->NIL;
+    }
+  }
+  return mk_hashtable(ctx, kind);
+}
+
+cell_t *hash_table_p(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  return is_hashtable(args[0]) ? ctx->TRUE : ctx->FALSE;
+}
+
+/* (hash-table-ref table key [thunk]) calls thunk if key is not in the
+ * table, without one that is an error */
+cell_t *hash_table_ref(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  cell_t *value = ht_ref(ctx, args[0], args[1], CONSTANT_DELETED);
+  if (value != CONSTANT_DELETED) {
+    return value;
+  } else if (n < 3) {
+    scheme_error(ctx, "hash-table-ref: no such key");
+  } else if (!is_primop(args[2]) && !is_lambda(args[2])) {
+    printf("ERROR: hash-table-ref: cannot apply\n");
+    return ctx->NIL;
+  }
+  return apply_values(ctx, args[2], ctx->roots_pos, 0, args[2]);
+}
+
+cell_t *hash_table_ref_default(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  return ht_ref(ctx, args[0], args[1], args[2]);
+}
+
+cell_t *hash_table_set(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  ht_set(ctx, args[0], args[1], args[2]);
+  return ctx->NIL;
+}
+
+cell_t *hash_table_delete(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  ht_delete(ctx, args[0], args[1]);
+  return ctx->NIL;
+}
+
+cell_t *hash_table_contains(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  return ht_ref(ctx, args[0], args[1], CONSTANT_DELETED) != CONSTANT_DELETED
+    ? ctx->TRUE : ctx->FALSE;
+}
+
+cell_t *hash_table_count(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  return ht_slots(args[0])[HT_COUNT];
+}
+
+/* (hash-table-update!/default table key f default) stores (f value), with
+ * value default if key is not in the table */
+cell_t *hash_table_update(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  if (!is_primop(args[2]) && !is_lambda(args[2])) {
+    printf("ERROR: hash-table-update!/default: cannot apply\n");
+    return ctx->NIL;
+  }
+  size_t base = ctx->roots_pos;
+  push_root(ctx, ht_ref(ctx, args[0], args[1], args[3]));
+  cell_t *value = apply_values(ctx, args[2], base, 1, args[2]);
+  ctx->roots_pos = base;
+  push_root(ctx, value);
+  ht_set(ctx, args[0], args[1], value);
+  return ctx->NIL;
+}
+
+/* The entries as a list of keys (what 0), values (1) or pairs (2). The
+ * entries not moved yet are still in HT_OLD. */
+static cell_t *ht_to_list(scheme_ctx_t *ctx, cell_t *table, int what)
+{
+  cell_t *ret = ctx->NIL;
+  for (int slot = HT_ENTRIES; slot <= HT_OLD; ++slot) {
+    cell_t *entries = ht_slots(table)[slot];
+    if (entries == ctx->FALSE) {
+      continue;
+    }
+    for (size_t i = ht_capacity(entries); i-- > 0; ) {
+      cell_t *key = vector_ref(entries, 2 * i);
+      if (key == HT_FREE || key == CONSTANT_DELETED) {
+        continue;
+      }
+      cell_t *value = vector_ref(entries, 2 * i + 1);
+      if (what == 2) {
+        value = cons(ctx, key, value);
+      }
+      ret = cons(ctx, what ? value : key, ret);
+    }
+  }
+  return ret;
+}
+
+cell_t *hash_table_keys(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  return ht_to_list(ctx, args[0], 0);
+}
+
+cell_t *hash_table_values(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  return ht_to_list(ctx, args[0], 1);
+}
+
+cell_t *hash_table_to_alist(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  return ht_to_list(ctx, args[0], 2);
+}
+
+/* (hash-table-walk table f) calls (f key value) for every entry. It walks
+ * a copy, so f may change the table. */
+cell_t *hash_table_walk(scheme_ctx_t *ctx, cell_t **args, int n)
+{
+  if (!is_primop(args[1]) && !is_lambda(args[1])) {
+    printf("ERROR: hash-table-walk: cannot apply\n");
+    return ctx->NIL;
+  }
+  cell_t *entries = ht_to_list(ctx, args[0], 2);
+  size_t base = ctx->roots_pos;
+  for (; is_pair(entries); entries = _cdr(entries)) {
+    push_root(ctx, _car(_car(entries)));
+    push_root(ctx, _cdr(_car(entries)));
+    apply_values(ctx, args[1], base, 2, args[1]);
+    ctx->roots_pos = base;
+  }
+  return ctx->NIL;
+}
+
+/* nodes, each comment gives the slots */
+
+#define node_slots(node) record_slots(node)
+#define node_size(node) ((node)->u.record.size)
+
+/* value */
+static cell_t *node_const(scheme_ctx_t *ctx, cell_t *node, tail_t *tail)
+{
+  return node_slots(node)[0];
+}
+
+/* symbol */
+static cell_t *node_global(scheme_ctx_t *ctx, cell_t *node, tail_t *tail)
+{
+  return env_resolve(ctx, node_slots(node)[0]);
+}
+
+/* symbol, depth, index */
+static cell_t *node_local(scheme_ctx_t *ctx, cell_t *node, tail_t *tail)
+{
+  cell_t **slots = node_slots(node);
+  cell_t *frame = frame_up(ctx, fixnum_value(slots[1]));
+  return record_slots(frame)[FRAME_SLOTS + fixnum_value(slots[2])];
+}
+
+/* symbol, 0, index */
+static cell_t *node_local0(scheme_ctx_t *ctx, cell_t *node, tail_t *tail)
+{
+  int index = fixnum_value(node_slots(node)[2]);
+  return record_slots(ctx->frame)[FRAME_SLOTS + index];
+}
+
+/* symbol, depth, index, value */
+static cell_t *node_define_local(scheme_ctx_t *ctx, cell_t *node,
+    tail_t *tail)
+{
+  cell_t **slots = node_slots(node);
+  cell_t *value = eval_node(ctx, slots[3], NULL);
+  return local_set(ctx, fixnum_value(slots[1]), fixnum_value(slots[2]),
+      value);
+}
+
+/* symbol, (), (), value */
+static cell_t *node_define_global(scheme_ctx_t *ctx, cell_t *node,
+    tail_t *tail)
+{
+  cell_t **slots = node_slots(node);
+  return env_define(ctx, slots[0], eval_node(ctx, slots[3], NULL));
+}
+
+/* test, consequent, alternative */
+static cell_t *node_if(scheme_ctx_t *ctx, cell_t *node, tail_t *tail)
+{
+  cell_t **slots = node_slots(node);
+  if (is_true(ctx, eval_node(ctx, slots[0], NULL))) {
+    return eval_node(ctx, slots[1], tail);
+  }
+  return eval_node(ctx, slots[2], tail);
+}
+
+/* body... */
+static cell_t *node_begin(scheme_ctx_t *ctx, cell_t *node, tail_t *tail)
+{
+  cell_t **slots = node_slots(node);
+  size_t last = node_size(node) - 1;
+  for (size_t i = 0; i < last; ++i) {
+    eval_node(ctx, slots[i], NULL);
+  }
+  return eval_node(ctx, slots[last], tail);
+}
+
+/* proc */
+static cell_t *node_lambda(scheme_ctx_t *ctx, cell_t *node, tail_t *tail)
+{
+  return mk_lambda(ctx, node_slots(node)[0]);
+}
+
+/* proc */
+static cell_t *node_macro(scheme_ctx_t *ctx, cell_t *node, tail_t *tail)
+{
+  return mk_macro(ctx, node_slots(node)[0]);
+}
+
+/* template, with the unquoted expressions analyzed */
+static cell_t *node_quasiquote(scheme_ctx_t *ctx, cell_t *node, tail_t *tail)
+{
+  return eval_quasiquote(ctx, node_slots(node)[0]);
+}
+
+static cell_t *analyze_in_frame(scheme_ctx_t *ctx, cell_t *obj);
+
+/* call fn with the n values on the root stack from base on */
+static cell_t *apply_values(scheme_ctx_t *ctx, cell_t *fn, size_t base, int n,
+    cell_t *source)
+{
+  if (is_lambda(fn)) {
+    cell_t *frame = lambda_frame(ctx, fn, base, n);
+    return frame ? run_lambda(ctx, fn, frame) : ctx->NIL;
+  } else if (is_primop(fn)) {
+    return apply_primop(ctx, fn, &ctx->roots[base], n);
+  } else if (is_macro(fn)) {
+    cell_t *code = analyze_in_frame(ctx, macro_expand(ctx, fn, source));
+    return eval_node(ctx, code, NULL);
+  } else if (!is_null(ctx, fn)) {
+    printf("cannot apply\n");
+    print_obj(ctx, source);
+    printf("\n");
+  }
+  return ctx->NIL;
+}
+
+/* (apply f list) with apply below its n arguments on the stack from base
+ * on: put f and the elements of the list there instead, returns their
+ * number or -1 when it is left to apply(), which reports the errors */
+static int spread_apply(scheme_ctx_t *ctx, size_t base, int n)
+{
+  if (n < 1 || n > 2 || !is_lambda(ctx->roots[base])) {
+    return -1;
+  }
+  cell_t *list = n == 2 ? ctx->roots[base + 1] : ctx->NIL;
+  if (!is_null(ctx, list) && !is_pair(list)) {
+    return -1;
+  }
+  int count = list_length(list);
+  ctx->roots[base - 1] = ctx->roots[base];
+  ctx->roots_pos = base;
+  for (; is_pair(list); list = _cdr(list)) {
+    push_root(ctx, _car(list));
+  }
+  return count;
+}
+
+#define is_apply(obj) (is_primop(obj) && (obj)->u.primop->fn == &apply)
+
+/* The code for a call whose callee turned out to be a macro when it ran,
+ * not known to be one when the call was analyzed. The expansion is kept in
+ * the call node with the macro it came from and used again as long as the
+ * callee is the same macro; a redefined macro is a new one and expands
+ * anew. */
+static cell_t *expand_call(scheme_ctx_t *ctx, cell_t *node, cell_t *macro)
+{
+  cell_t **slots = node_slots(node);
+  if (is_pair(slots[1]) && _car(slots[1]) == macro) {
+    return _cdr(slots[1]);
+  }
+  cell_t *code = analyze_in_frame(ctx, macro_expand(ctx, macro, slots[0]));
+  cell_t *expansion = cons(ctx, macro, code);
+  gc_write_barrier(ctx, node, slots[1], expansion);
+  slots[1] = expansion;
+  return code;
+}
+
+/* call fn with the arguments of the call node */
+static cell_t *call(scheme_ctx_t *ctx, cell_t *node, cell_t *fn, tail_t *tail)
+{
+  cell_t **slots = node_slots(node);
+  int n = node_size(node) - 3;
+  size_t base = ctx->roots_pos;
+  if (is_macro(fn)) {
+    return eval_node(ctx, expand_call(ctx, node, fn), tail);
+  }
+  for (int i = 0; i < n; ++i) {
+    eval_node(ctx, slots[3 + i], NULL);
+  }
+  if (tail && is_apply(fn)) {
+    int count = spread_apply(ctx, base, n);
+    if (count >= 0) {
+      fn = ctx->roots[base - 1];
+      n = count;
+    }
+  }
+  if (tail && is_lambda(fn)) {
+    /* TAIL CALL: return the lambda and its frame to run_lambda() */
+    tail->lambda = fn;
+    tail->frame = lambda_frame(ctx, fn, base, n);
+    return ctx->NIL;
+  }
+  return apply_values(ctx, fn, base, n, slots[0]);
 }
 
+/* source, expansion, function, arguments... */
+static cell_t *node_call(scheme_ctx_t *ctx, cell_t *node, tail_t *tail)
+{
+  return call(ctx, node, eval_node(ctx, node_slots(node)[2], NULL), tail);
+}
 
-static int get_args(cell_t *args, int nr, int types[], cell_t *ret[])
+/* source, expansion, symbol, arguments... */
+static cell_t *node_call_global(scheme_ctx_t *ctx, cell_t *node,
+    tail_t *tail)
 {
-  int i = 0;
-  while (i < nr) {
-    if (!is_pair(args)) {
-      printf("ERROR: missing argument, expected %d given %d\n", nr, i);
-      return -1;
-    }
-    cell_t *obj = _car(args);
-    if (obj->type != types[i]) {
-      if (types[i] != CELL_T_EMPTY) {
-        printf("ERROR: %s expected %s given\n",
-            get_type_name(types[i]), get_type_name(obj->type));
-        return -1;
-      }
-    }
-    ret[i] = obj;
-    args = _cdr(args);
-    ++i;
+  cell_t *fn = push_root(ctx, env_resolve(ctx, node_slots(node)[2]));
+  return call(ctx, node, fn, tail);
+}
+
+/* Builtins that optimize() inlines: calls to them with the right number of
+ * arguments become node_prim, which does the work itself while the global
+ * still holds the primop and the arguments have the right types. */
+enum prim_e {
+  PRIM_ADD, PRIM_SUB, PRIM_MUL, PRIM_MODULO,
+  /* the comparisons, in the order of the vm branch opcodes */
+  PRIM_NUM_EQ, PRIM_LT, PRIM_GT, PRIM_LT_EQ, PRIM_GT_EQ, PRIM_EQ,
+  PRIM_CONS, PRIM_CAR, PRIM_CDR,
+  PRIM_COUNT
+};
+
+#define is_comparison(prim) ((prim) >= PRIM_NUM_EQ && (prim) <= PRIM_EQ)
+
+static struct {
+  char *name;
+  primop_fn fn;
+  int nargs;
+} prims[PRIM_COUNT] = {
+  [PRIM_ADD] = {"+", &op_plus, 2},
+  [PRIM_SUB] = {"-", &op_minus, 2},
+  [PRIM_MUL] = {"*", &op_mul, 2},
+  [PRIM_MODULO] = {"modulo", &modulo, 2},
+  [PRIM_NUM_EQ] = {"=", &integer_eq, 2},
+  [PRIM_LT] = {"<", &op_lt, 2},
+  [PRIM_GT] = {">", &op_gt, 2},
+  [PRIM_LT_EQ] = {"<=", &op_lt_eq, 2},
+  [PRIM_GT_EQ] = {">=", &op_gt_eq, 2},
+  [PRIM_EQ] = {"eq?", &eq, 2},
+  [PRIM_CONS] = {"cons", &primop_cons, 2},
+  [PRIM_CAR] = {"car", &car, 1},
+  [PRIM_CDR] = {"cdr", &cdr, 1},
+};
+
+#define is_builtin(obj, index) \
+  (is_primop(obj) && (obj)->u.primop->fn == prims[index].fn)
+
+/* the result of the builtin, NULL if the arguments do not fit the fast
+ * path and the primop has to run (and report the error) */
+static cell_t *prim_fast(scheme_ctx_t *ctx, int prim, cell_t **args)
+{
+  switch (prim) {
+    case PRIM_EQ:
+      return args[0] == args[1] ? ctx->TRUE : ctx->FALSE;
+    case PRIM_CONS:
+      return cons(ctx, args[0], args[1]);
+    case PRIM_CAR:
+      return is_pair(args[0]) ? _car(args[0]) : NULL;
+    case PRIM_CDR:
+      return is_pair(args[0]) ? _cdr(args[0]) : NULL;
   }
-  int to_many_args = 0;
-  while (is_pair(args)) {
-    ++to_many_args;
-    args = _cdr(args);
+  if (!is_fixnum(args[0]) || !is_fixnum(args[1])) {
+    return NULL;
   }
-  if (to_many_args) {
-    printf("ERROR: to many arguments %d expected %d given\n",
-        nr, nr + to_many_args);
-    return -1;
+  intptr_t x = fixnum_value(args[0]);
+  intptr_t y = fixnum_value(args[1]);
+  intptr_t z;
+  switch (prim) {
+    case PRIM_ADD:
+      return fixnum_add_overflow(x, y, &z) ? NULL : mk_fixnum(z);
+    case PRIM_SUB:
+      return fixnum_sub_overflow(x, y, &z) ? NULL : mk_fixnum(z);
+    case PRIM_MUL:
+      return fixnum_mul_overflow(x, y, &z) ? NULL : mk_fixnum(z);
+    case PRIM_MODULO:
+      return y == 0 || y == -1 ? NULL : mk_fixnum(x % y);
+    case PRIM_NUM_EQ:
+      return x == y ? ctx->TRUE : ctx->FALSE;
+    case PRIM_LT:
+      return x < y ? ctx->TRUE : ctx->FALSE;
+    case PRIM_GT:
+      return x > y ? ctx->TRUE : ctx->FALSE;
+    case PRIM_LT_EQ:
+      return x <= y ? ctx->TRUE : ctx->FALSE;
+    case PRIM_GT_EQ:
+      return x >= y ? ctx->TRUE : ctx->FALSE;
   }
-  return 0;
+  return NULL;
 }
 
-cell_t *car(scheme_ctx_t *ctx, cell_t *args)
+/* call node, prim, arguments... */
+static cell_t *node_prim(scheme_ctx_t *ctx, cell_t *node, tail_t *tail)
 {
-  cell_t *arg[1];
-  int types[1] = {CELL_T_PAIR};
-  if (get_args(args, 1, types, arg)) {
-    return ctx->NIL;
+  cell_t **slots = node_slots(node);
+  int prim = fixnum_value(slots[1]);
+  cell_t *fn = push_root(ctx, env_resolve(ctx, node_slots(slots[0])[2]));
+  if (!is_builtin(fn, prim)) {
+    /* redefined, call whatever it is now */
+    return call(ctx, slots[0], fn, tail);
+  }
+  cell_t *args[2];
+  for (int i = 0; i < prims[prim].nargs; ++i) {
+    args[i] = eval_node(ctx, slots[2 + i], NULL);
   }
-  return _car(arg[0]);
+  cell_t *ret = prim_fast(ctx, prim, args);
+  return ret ? ret : apply_primop(ctx, fn, args, prims[prim].nargs);
 }
 
-cell_t *cdr(scheme_ctx_t *ctx, cell_t *args)
+/* value, epoch, node: the value node computes as long as no primop was
+ * redefined since it was folded */
+static cell_t *node_folded(scheme_ctx_t *ctx, cell_t *node, tail_t *tail)
 {
-  cell_t *arg[1];
-  int types[1] = {CELL_T_PAIR};
-  if (get_args(args, 1, types, arg)) {
-    return ctx->NIL;
+  cell_t **slots = node_slots(node);
+  if (fixnum_value(slots[1]) == ctx->builtin_epoch) {
+    return slots[0];
   }
-  return _cdr(arg[0]);
+  return eval_node(ctx, slots[2], tail);
 }
 
-cell_t *op_minus(scheme_ctx_t *ctx, cell_t *args) {
-  int i = 0;
-  int ret = 0;
-  int len = list_length(args);
-  while (!is_null(ctx, args)) {
-    if (is_integer(_car(args))) {
-      if (i == 0 && len > 1) {
-        ret = _car(args)->u.integer;
-      } else {
-        ret -= _car(args)->u.integer;
+/* branch, epoch, node: an if whose test was folded runs the branch it
+ * takes as long as no primop was redefined since */
+static cell_t *node_if_folded(scheme_ctx_t *ctx, cell_t *node, tail_t *tail)
+{
+  cell_t **slots = node_slots(node);
+  if (fixnum_value(slots[1]) == ctx->builtin_epoch) {
+    return eval_node(ctx, slots[0], tail);
+  }
+  return eval_node(ctx, slots[2], tail);
+}
+
+/* Flonum builtins: a tree of calls to them is computed by node_flonum() on
+ * unboxed doubles, and only its result gets boxed. The fl ops take flonums
+ * only, so they always give one; the generic ops join a tree when all their
+ * arguments are known to be flonums, constants or ops of the tree. The
+ * arguments of a tree that are not ops of it are its leaves. */
+enum flop_e {
+  FLOP_ADD, FLOP_SUB, FLOP_MUL, FLOP_DIV, FLOP_INEXACT,
+  /* these give a boolean and can only be the root of a tree */
+  FLOP_EQ, FLOP_LT, FLOP_GT, FLOP_LT_EQ, FLOP_GT_EQ
+};
+
+static char *flop_names[] = {
+  "fl+", "fl-", "fl*", "fl/", "inexact", "fl=", "fl<", "fl>", "fl<=", "fl>="
+};
+
+static struct {
+  char *name;
+  primop_fn fn;
+  int op;
+  int nargs;
+  int generic;  /* only with arguments known to be flonums */
+} flops[] = {
+  {"fl+", &fl_add, FLOP_ADD, 2, 0},
+  {"fl-", &fl_sub, FLOP_SUB, 2, 0},
+  {"fl*", &fl_mul, FLOP_MUL, 2, 0},
+  {"fl/", &fl_div, FLOP_DIV, 2, 0},
+  {"fl=", &fl_eq, FLOP_EQ, 2, 0},
+  {"fl<", &fl_lt, FLOP_LT, 2, 0},
+  {"fl>", &fl_gt, FLOP_GT, 2, 0},
+  {"fl<=", &fl_lt_eq, FLOP_LT_EQ, 2, 0},
+  {"fl>=", &fl_gt_eq, FLOP_GT_EQ, 2, 0},
+  {"inexact", &inexact, FLOP_INEXACT, 1, 0},
+  {"exact->inexact", &inexact, FLOP_INEXACT, 1, 0},
+  {"+", &op_plus, FLOP_ADD, 2, 1},
+  {"-", &op_minus, FLOP_SUB, 2, 1},
+  {"*", &op_mul, FLOP_MUL, 2, 1},
+  {"/", &op_div, FLOP_DIV, 2, 1},
+  {"=", &integer_eq, FLOP_EQ, 2, 1},
+  {"<", &op_lt, FLOP_LT, 2, 1},
+  {">", &op_gt, FLOP_GT, 2, 1},
+  {"<=", &op_lt_eq, FLOP_LT_EQ, 2, 1},
+  {">=", &op_gt_eq, FLOP_GT_EQ, 2, 1},
+};
+#define FLOP_COUNT (sizeof(flops) / sizeof(flops[0]))
+
+static cell_t *node_flonum(scheme_ctx_t *ctx, cell_t *node, tail_t *tail);
+
+#define flop_of(node) flops[fixnum_value(node_slots(node)[1])]
+/* an op inside a tree, not a leaf */
+#define is_flonum_op(node) \
+  ((node)->u.record.exec == &node_flonum && flop_of(node).op < FLOP_EQ)
+
+/* Computes a tree on doubles, leaves[*i] on are the values of its leaves.
+ * Returns 0 if an op of it was redefined or a leaf is not a flonum. */
+static int flonum_unboxed(cell_t *node, cell_t **leaves, int *i, double *ret)
+{
+  cell_t **slots = node_slots(node);
+  cell_t *fn = node_slots(slots[0])[2]->u.symbol.value;
+  if (!is_primop(fn) || fn->u.primop->fn != flop_of(node).fn) {
+    return 0;
+  }
+  int op = flop_of(node).op;
+  double x[2];
+  for (int j = 0; j < flop_of(node).nargs; ++j) {
+    if (is_flonum_op(slots[2 + j])) {
+      if (!flonum_unboxed(slots[2 + j], leaves, i, &x[j])) {
+        return 0;
       }
+    } else if (is_flonum(leaves[*i])
+        || (op == FLOP_INEXACT && is_number(leaves[*i]))) {
+      x[j] = number_to_double(leaves[(*i)++]);
     } else {
-      printf("ERROR: integer expected %s given\n", get_type_name(_car(args)->type));
-      return ctx->NIL;
+      return 0;
     }
-    ++i;
-    args = _cdr(args);
   }
-  if (i < 1) {
-    printf("ERROR: not enough arguments for '-'\n");
-    return ctx->NIL;
+  switch (op) {
+    case FLOP_ADD:
+      *ret = x[0] + x[1];
+      break;
+    case FLOP_SUB:
+      *ret = x[0] - x[1];
+      break;
+    case FLOP_MUL:
+      *ret = x[0] * x[1];
+      break;
+    case FLOP_DIV:
+      *ret = x[0] / x[1];
+      break;
+    case FLOP_INEXACT:
+      *ret = x[0];
+      break;
+    case FLOP_EQ:
+      *ret = x[0] == x[1];
+      break;
+    case FLOP_LT:
+      *ret = x[0] < x[1];
+      break;
+    case FLOP_GT:
+      *ret = x[0] > x[1];
+      break;
+    case FLOP_LT_EQ:
+      *ret = x[0] <= x[1];
+      break;
+    case FLOP_GT_EQ:
+      *ret = x[0] >= x[1];
+      break;
   }
-  return mk_integer(ctx, ret);
+  return 1;
 }
 
-cell_t *op_plus(scheme_ctx_t *ctx, cell_t *args)
+/* the same by calling whatever the globals hold now, for when the unboxed
+ * way does not do; leaves its value on the root stack */
+static cell_t *flonum_generic(scheme_ctx_t *ctx, cell_t *node, cell_t **leaves,
+    int *i)
 {
-  int i = 0;
-  int ret = 0;
-  while (!is_null(ctx, args)) {
-    if (is_integer(_car(args))) {
-      if (i == 0) {
-        ret = _car(args)->u.integer;
-      } else {
-        ret += _car(args)->u.integer;
-      }
+  cell_t **slots = node_slots(node);
+  int n = flop_of(node).nargs;
+  size_t base = ctx->roots_pos;
+  for (int j = 0; j < n; ++j) {
+    if (is_flonum_op(slots[2 + j])) {
+      flonum_generic(ctx, slots[2 + j], leaves, i);
     } else {
-      printf("ERROR: integer expected %s given\n", get_type_name(_car(args)->type));
-      return ctx->NIL;
+      push_root(ctx, leaves[(*i)++]);
     }
-    ++i;
-    args = _cdr(args);
   }
-  return mk_integer(ctx, ret);
+  cell_t *fn = push_root(ctx, env_resolve(ctx, node_slots(slots[0])[2]));
+  cell_t *ret = apply_values(ctx, fn, base, n, node_slots(slots[0])[0]);
+  ctx->roots_pos = base;
+  return push_root(ctx, ret);
 }
 
-cell_t *op_mul(scheme_ctx_t *ctx, cell_t *args) {
+/* the value of a tree given the values of its leaves */
+static cell_t *flonum_run(scheme_ctx_t *ctx, cell_t *node, cell_t **leaves)
+{
   int i = 0;
-  int ret = 1;
-  while (!is_null(ctx, args)) {
-    if (is_integer(_car(args))) {
-      ret *= _car(args)->u.integer;
+  double value;
+  if (!flonum_unboxed(node, leaves, &i, &value)) {
+    i = 0;
+    return flonum_generic(ctx, node, leaves, &i);
+  }
+  if (flop_of(node).op >= FLOP_EQ) {
+    return value != 0 ? ctx->TRUE : ctx->FALSE;
+  }
+  return mk_flonum(ctx, value);
+}
+
+/* evaluates the leaves of a tree in order onto the root stack, returns
+ * their number */
+static int flonum_leaves(scheme_ctx_t *ctx, cell_t *node)
+{
+  cell_t **slots = node_slots(node);
+  int n = 0;
+  for (int j = 0; j < flop_of(node).nargs; ++j) {
+    if (is_flonum_op(slots[2 + j])) {
+      n += flonum_leaves(ctx, slots[2 + j]);
     } else {
-      printf("ERROR: integer expected %s given\n", get_type_name(_car(args)->type));
-      return ctx->NIL;
+      /* without the temporaries of the evaluation */
+      size_t pos = ctx->roots_pos;
+      cell_t *value = eval_node(ctx, slots[2 + j], NULL);
+      ctx->roots_pos = pos;
+      push_root(ctx, value);
+      n += 1;
     }
-    ++i;
-    args = _cdr(args);
   }
-  return mk_integer(ctx, ret);
+  return n;
 }
 
-cell_t *op_div(scheme_ctx_t *ctx, cell_t *args) {
-  int i = 0;
-  int ret = 1;
-  int len = list_length(args);
-  while (!is_null(ctx, args)) {
-    if (is_integer(_car(args))) {
-      if (i == 0 && len > 1) {
-        ret = _car(args)->u.integer;
-      } else {
-        ret /= _car(args)->u.integer;
-      }
+/* call node, index in flops, arguments... */
+static cell_t *node_flonum(scheme_ctx_t *ctx, cell_t *node, tail_t *tail)
+{
+  size_t base = ctx->roots_pos;
+  flonum_leaves(ctx, node);
+  cell_t *ret = flonum_run(ctx, node, &ctx->roots[base]);
+  ctx->roots_pos = base;
+  return push_root(ctx, ret);
+}
+
+/* analyze */
+
+/* the names bound by one lambda while its body is analyzed */
+typedef struct scope_s scope_t;
+struct scope_s {
+  scope_t *parent;
+  cell_t **names;
+  int count;
+  int size;
+  int fixed;  /* made from a running frame, which cannot grow */
+};
+
+static int scope_index(scope_t *scope, cell_t *symbol)
+{
+  for (int i = 0; i < scope->count; ++i) {
+    if (scope->names[i] == symbol) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static int scope_add(scope_t *scope, cell_t *symbol)
+{
+  int i = scope_index(scope, symbol);
+  if (i >= 0) {
+    return i;
+  }
+  if (scope->count >= scope->size) {
+    scope->size = scope->size ? scope->size * 2 : 8;
+    scope->names = realloc(scope->names, sizeof(cell_t *) * scope->size);
+  }
+  scope->names[scope->count] = symbol;
+  return scope->count++;
+}
+
+static int scope_binds(scope_t *scope, cell_t *symbol)
+{
+  for (; scope; scope = scope->parent) {
+    if (scope_index(scope, symbol) >= 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static cell_t *mk_node(scheme_ctx_t *ctx, node_fn exec, size_t size)
+{
+  cell_t *ret = mk_record(ctx, CELL_T_NODE, size);
+  ret->u.record.exec = exec;
+  return ret;
+}
+
+static cell_t *analyze_const(scheme_ctx_t *ctx, cell_t *value)
+{
+  cell_t *node = mk_node(ctx, &node_const, 1);
+  node_slots(node)[0] = value;
+  return node;
+}
+
+/* what a form that failed to analyze evaluates to */
+#define analyze_error(ctx) analyze_const(ctx, (ctx)->NIL)
+
+static cell_t *analyze_symbol(scheme_ctx_t *ctx, cell_t *symbol,
+    scope_t *scope)
+{
+  int depth = 0;
+  for (; scope; scope = scope->parent, ++depth) {
+    int i = scope_index(scope, symbol);
+    if (i >= 0) {
+      cell_t *node = mk_node(ctx, depth ? &node_local : &node_local0, 3);
+      cell_t **slots = node_slots(node);
+      slots[0] = symbol;
+      slots[1] = mk_fixnum(depth);
+      slots[2] = mk_fixnum(i);
+      return node;
+    }
+  }
+  cell_t *node = mk_node(ctx, &node_global, 1);
+  node_slots(node)[0] = symbol;
+  return node;
+}
+
+cell_t *analyze(scheme_ctx_t *ctx, cell_t *obj, scope_t *scope);
+
+/* Analyzes obj and pushes the node, without the temporaries of the
+ * analysis, so the nodes of a form are found at consecutive positions of
+ * the root stack. */
+static void analyze_push(scheme_ctx_t *ctx, cell_t *obj, scope_t *scope)
+{
+  size_t pos = ctx->roots_pos;
+  cell_t *node = analyze(ctx, obj, scope);
+  ctx->roots_pos = pos;
+  push_root(ctx, node);
+}
+
+static int analyze_onto_roots(scheme_ctx_t *ctx, cell_t *list, scope_t *scope)
+{
+  int n = 0;
+  for (; is_pair(list); list = _cdr(list), ++n) {
+    analyze_push(ctx, _car(list), scope);
+  }
+  return n;
+}
+
+/* node with the n nodes on the root stack from base on as its last slots */
+static cell_t *mk_node_from_roots(scheme_ctx_t *ctx, node_fn exec,
+    size_t first, size_t base, int n)
+{
+  cell_t *node = mk_node(ctx, exec, first + n);
+  for (int i = 0; i < n; ++i) {
+    node_slots(node)[first + i] = ctx->roots[base + i];
+  }
+  return node;
+}
+
+static cell_t *analyze_list(scheme_ctx_t *ctx, cell_t *list, scope_t *scope)
+{
+  if (!is_pair(list)) {
+    return list;
+  }
+  cell_t *obj = analyze(ctx, _car(list), scope);
+  return cons(ctx, obj, analyze_list(ctx, _cdr(list), scope));
+}
+
+static cell_t *analyze_quasiquote(scheme_ctx_t *ctx, cell_t *list,
+    scope_t *scope)
+{
+  if (!is_pair(list)) {
+    return list;
+  }
+  if (ctx->SYMBOL_UNQUOTE == _car(list)) {
+    return cons(ctx, _car(list), analyze_list(ctx, _cdr(list), scope));
+  }
+  cell_t *obj = _car(list);
+  if (is_pair(obj)) {
+    if (ctx->SYMBOL_UNQUOTE == _car(obj)
+        || ctx->SYMBOL_UNQUOTE_SPLICE == _car(obj)) {
+      obj = cons(ctx, _car(obj), analyze_list(ctx, _cdr(obj), scope));
     } else {
-      printf("ERROR: integer expected %s given\n", get_type_name(_car(args)->type));
-      return ctx->NIL;
+      obj = analyze_quasiquote(ctx, obj, scope);
     }
-    ++i;
-    args = _cdr(args);
   }
-  if (i < 1) {
-    printf("ERROR: not enough arguments for '/'\n");
-    return ctx->NIL;
+  return cons(ctx, obj, analyze_quasiquote(ctx, _cdr(list), scope));
+}
+
+/* names a body defines, they get slots in the frame of its lambda */
+static void scan_defines(scheme_ctx_t *ctx, cell_t *body, scope_t *scope)
+{
+  if (!is_pair(body) || !is_pair(_cdr(body))) {
+    return;
+  }
+  cell_t *name = _car(_cdr(body));
+  if (_car(body) == ctx->SYMBOL_DEFINE && is_sym(name)) {
+    scope_add(scope, name);
+  } else if (_car(body) == ctx->SYMBOL_MACRO && is_pair(name)
+      && is_sym(_car(name))) {
+    scope_add(scope, _car(name));
+  } else if (_car(body) == ctx->SYMBOL_BEGIN) {
+    for (cell_t *l = _cdr(body); is_pair(l); l = _cdr(l)) {
+      scan_defines(ctx, _car(l), scope);
+    }
   }
-  return mk_integer(ctx, ret);
 }
 
-cell_t *op_gt(scheme_ctx_t *ctx, cell_t *args) {
-  cell_t *arg[2];
-  int types[2] = {CELL_T_INTEGER, CELL_T_INTEGER};
-  if (get_args(args, 2, types, arg)) {
-    return ctx->NIL;
+/* Definition of name as the value of the node 'value'. The name has to be
+ * added to the scope before the value is analyzed, see define_index(). */
+static cell_t *analyze_definition(scheme_ctx_t *ctx, cell_t *name, int index,
+    cell_t *value)
+{
+  cell_t *node = mk_node(ctx,
+      index < 0 ? &node_define_global : &node_define_local, 4);
+  cell_t **slots = node_slots(node);
+  slots[0] = name;
+  if (index >= 0) {
+    slots[1] = mk_fixnum(0);
+    slots[2] = mk_fixnum(index);
   }
-  return arg[0]->u.integer > arg[1]->u.integer ? ctx->TRUE : ctx->FALSE;
+  slots[3] = value;
+  return node;
 }
 
-cell_t *op_gt_eq(scheme_ctx_t *ctx, cell_t *args) {
-  cell_t *arg[2];
-  int types[2] = {CELL_T_INTEGER, CELL_T_INTEGER};
-  if (get_args(args, 2, types, arg)) {
-    return ctx->NIL;
+/* frame slot for a definition, -1 for a global one and -2 on error */
+static int define_index(scheme_ctx_t *ctx, cell_t *name, scope_t *scope)
+{
+  if (!scope) {
+    return -1;
+  }
+  if (scope->fixed && scope_index(scope, name) < 0) {
+    printf("ERROR: cannot define '%s' here\n", name->u.symbol.name);
+    return -2;
   }
-  return arg[0]->u.integer >= arg[1]->u.integer ? ctx->TRUE : ctx->FALSE;
+  return scope_add(scope, name);
 }
 
-cell_t *op_lt(scheme_ctx_t *ctx, cell_t *args) {
-  cell_t *arg[2];
-  int types[2] = {CELL_T_INTEGER, CELL_T_INTEGER};
-  if (get_args(args, 2, types, arg)) {
-    return ctx->NIL;
+static cell_t *compile(scheme_ctx_t *ctx, cell_t *body);
+
+/* optimize */
+
+static void node_set(scheme_ctx_t *ctx, cell_t *node, int i, cell_t *value)
+{
+  gc_write_barrier(ctx, node, node_slots(node)[i], value);
+  node_slots(node)[i] = value;
+}
+
+#define is_constant_node(node) \
+  ((node)->u.record.exec == &node_const \
+      || (node)->u.record.exec == &node_folded)
+
+/* known to give a flonum */
+#define is_flonum_node(node) \
+  (is_flonum_op(node) \
+      || (is_constant_node(node) && is_flonum(node_slots(node)[0])))
+
+/* a call to a flonum builtin becomes node_flonum, folded when its
+ * arguments are constants; NULL if it is no such call */
+static cell_t *optimize_flonum(scheme_ctx_t *ctx, cell_t *node)
+{
+  cell_t **slots = node_slots(node);
+  int n = node_size(node) - 3;
+  cell_t *symbol = slots[2];
+  cell_t *fn = symbol->u.symbol.value;
+  int proven = 1;
+  for (int i = 0; i < n; ++i) {
+    proven = proven && is_flonum_node(slots[3 + i]);
+  }
+  size_t index;
+  for (index = 0; index < FLOP_COUNT; ++index) {
+    if (flops[index].nargs == n && (proven || !flops[index].generic)
+        && !strcmp(flops[index].name, symbol->u.symbol.name)
+        && is_primop(fn) && fn->u.primop->fn == flops[index].fn) {
+      break;
+    }
+  }
+  if (index == FLOP_COUNT) {
+    return NULL;
+  }
+  cell_t *tree = mk_node(ctx, &node_flonum, 2 + n);
+  cell_t **tree_slots = node_slots(tree);
+  tree_slots[0] = node;
+  tree_slots[1] = mk_fixnum(index);
+  cell_t *values[2];
+  int constant = 1;
+  for (int i = 0; i < n; ++i) {
+    tree_slots[2 + i] = slots[3 + i];
+    values[i] = node_slots(slots[3 + i])[0];
+    constant = constant && is_constant_node(slots[3 + i]);
+  }
+  int i = 0;
+  double value;
+  if (!constant || !flonum_unboxed(tree, values, &i, &value)) {
+    return tree;
+  }
+  cell_t *folded = mk_node(ctx, &node_folded, 3);
+  node_slots(folded)[0] = flops[index].op < FLOP_EQ ? mk_flonum(ctx, value)
+      : value != 0 ? ctx->TRUE : ctx->FALSE;
+  node_slots(folded)[1] = mk_fixnum(ctx->builtin_epoch);
+  node_slots(folded)[2] = tree;
+  return folded;
+}
+
+/* a call to a global that holds an inlined builtin becomes node_prim, and
+ * is folded when its arguments are constants */
+static cell_t *optimize_call(scheme_ctx_t *ctx, cell_t *node)
+{
+  cell_t **slots = node_slots(node);
+  int n = node_size(node) - 3;
+  cell_t *symbol = slots[2];
+  cell_t *tree = optimize_flonum(ctx, node);
+  if (tree) {
+    return tree;
   }
-  return arg[0]->u.integer < arg[1]->u.integer ? ctx->TRUE : ctx->FALSE;
+  int prim;
+  for (prim = 0; prim < PRIM_COUNT; ++prim) {
+    if (prims[prim].nargs == n && !strcmp(prims[prim].name, symbol->u.symbol.name)
+        && is_builtin(symbol->u.symbol.value, prim)) {
+      break;
+    }
+  }
+  if (prim == PRIM_COUNT) {
+    return node;
+  }
+  cell_t *inlined = mk_node(ctx, &node_prim, 2 + n);
+  cell_t **inlined_slots = node_slots(inlined);
+  inlined_slots[0] = node;
+  inlined_slots[1] = mk_fixnum(prim);
+  cell_t *args[2];
+  int constant = prim != PRIM_CONS;  /* a new pair every time */
+  for (int i = 0; i < n; ++i) {
+    inlined_slots[2 + i] = slots[3 + i];
+    args[i] = node_slots(slots[3 + i])[0];
+    constant = constant && is_constant_node(slots[3 + i]);
+  }
+  cell_t *value = constant ? prim_fast(ctx, prim, args) : NULL;
+  if (!value) {
+    return inlined;
+  }
+  cell_t *folded = mk_node(ctx, &node_folded, 3);
+  node_slots(folded)[0] = value;
+  node_slots(folded)[1] = mk_fixnum(ctx->builtin_epoch);
+  node_slots(folded)[2] = inlined;
+  return folded;
+}
+
+/* Rewrites the nodes of a lambda body made by analyze(): inlines builtins
+ * and folds constants (see optimize_call()), and an if with a constant
+ * test becomes the branch taken. If the test was folded, that holds only
+ * until a primop is redefined (see node_if_folded()). */
+static cell_t *optimize(scheme_ctx_t *ctx, cell_t *node)
+{
+  node_fn exec = node->u.record.exec;
+  size_t first = 0;
+  size_t end = 0;
+  if (exec == &node_define_local || exec == &node_define_global) {
+    first = 3;
+    end = 4;
+  } else if (exec == &node_if || exec == &node_begin) {
+    end = node_size(node);
+  } else if (exec == &node_call || exec == &node_call_global) {
+    first = exec == &node_call ? 2 : 3;
+    end = node_size(node);
+  }
+  for (size_t i = first; i < end; ++i) {
+    node_set(ctx, node, i, optimize(ctx, node_slots(node)[i]));
+  }
+  cell_t **slots = node_slots(node);
+  if (exec == &node_call_global) {
+    return optimize_call(ctx, node);
+  } else if (exec == &node_if && slots[0]->u.record.exec == &node_const) {
+    return is_true(ctx, node_slots(slots[0])[0]) ? slots[1] : slots[2];
+  } else if (exec == &node_if && slots[0]->u.record.exec == &node_folded) {
+    cell_t *folded = mk_node(ctx, &node_if_folded, 3);
+    node_slots(folded)[0] = is_true(ctx, node_slots(slots[0])[0])
+      ? slots[1] : slots[2];
+    node_slots(folded)[1] = node_slots(slots[0])[1];
+    node_slots(folded)[2] = node;
+    return folded;
+  }
+  return node;
+}
+
+/* print the code a node stands for, inlined builtins as (%name ...) */
+static void print_node(scheme_ctx_t *ctx, cell_t *node)
+{
+  node_fn exec = node->u.record.exec;
+  cell_t **slots = node_slots(node);
+  size_t first = 0;
+  if (exec == &node_const) {
+    if (is_sym(slots[0]) || is_pair(slots[0]) || is_null(ctx, slots[0])) {
+      printf("'");
+    }
+    print_obj(ctx, slots[0]);
+    return;
+  } else if (exec == &node_folded) {
+    print_node(ctx, node_slots(slots[2])[0]);
+    printf(" => ");
+    print_obj(ctx, slots[0]);
+    return;
+  } else if (exec == &node_if_folded) {
+    print_node(ctx, slots[2]);
+    printf(" => ");
+    print_node(ctx, slots[0]);
+    return;
+  } else if (exec == &node_global || exec == &node_local
+      || exec == &node_local0) {
+    print_obj(ctx, slots[0]);
+    return;
+  } else if (exec == &node_define_local || exec == &node_define_global) {
+    printf("(define ");
+    print_obj(ctx, slots[0]);
+    printf(" ");
+    print_node(ctx, slots[3]);
+    printf(")");
+    return;
+  } else if (exec == &node_lambda || exec == &node_macro) {
+    printf(exec == &node_lambda ? "(lambda ...)" : "(macro ...)");
+    return;
+  } else if (exec == &node_quasiquote) {
+    printf("(quasiquote ...)");
+    return;
+  } else if (exec == &node_if) {
+    printf("(if");
+  } else if (exec == &node_begin) {
+    printf("(begin");
+  } else if (exec == &node_prim) {
+    printf("(%%%s", prims[fixnum_value(slots[1])].name);
+    first = 2;
+  } else if (exec == &node_flonum) {
+    printf("(%%%s", flop_names[flop_of(node).op]);
+    first = 2;
+  } else if (exec == &node_call_global) {
+    printf("(");
+    print_obj(ctx, slots[2]);
+    first = 3;
+  } else {
+    printf("(");
+    print_node(ctx, slots[2]);
+    first = 3;
+  }
+  for (size_t i = first; i < node_size(node); ++i) {
+    printf(" ");
+    print_node(ctx, slots[i]);
+  }
+  printf(")");
+}
+
+static cell_t *analyze_proc(scheme_ctx_t *ctx, scope_t *inner, int nparams,
+    int rest, cell_t *body)
+{
+  scan_defines(ctx, body, inner);
+  cell_t *code = optimize(ctx, analyze(ctx, body, inner));
+  cell_t *names = ctx->NIL;
+  for (int i = inner->count - 1; i >= 0; --i) {
+    names = cons(ctx, inner->names[i], names);
+  }
+  if (ctx->print_optimized) {
+    printf("optimized: (lambda (");
+    for (int i = 0; i < nparams + rest; ++i) {
+      printf(i ? " %s%s" : "%s%s", i == nparams ? ". " : "",
+          inner->names[i]->u.symbol.name);
+    }
+    printf(") ");
+    print_node(ctx, code);
+    printf(")\n");
+  }
+  free(inner->names);
+  cell_t *bytecode = ctx->engine == ENGINE_VM ? compile(ctx, code) : NULL;
+  cell_t *proc = mk_record(ctx, CELL_T_PROC, PROC_SIZE);
+  cell_t **slots = record_slots(proc);
+  slots[PROC_NPARAMS] = mk_fixnum(nparams);
+  slots[PROC_REST] = rest ? ctx->TRUE : ctx->FALSE;
+  slots[PROC_NSLOTS] = mk_fixnum(inner->count);
+  slots[PROC_NAMES] = names;
+  slots[PROC_BODY] = code;
+  if (bytecode) {
+    slots[PROC_CODE] = bytecode;
+  }
+  return proc;
 }
 
-cell_t *op_lt_eq(scheme_ctx_t *ctx, cell_t *args) {
+/* (lambda params body) */
+static cell_t *analyze_lambda(scheme_ctx_t *ctx, cell_t *args, scope_t *scope)
+{
   cell_t *arg[2];
-  int types[2] = {CELL_T_INTEGER, CELL_T_INTEGER};
+  int types[2] = {CELL_T_EMPTY, CELL_T_EMPTY};
   if (get_args(args, 2, types, arg)) {
-    return ctx->NIL;
+    return analyze_error(ctx);
+  }
+  if (!is_pair(arg[0]) && !is_sym(arg[0]) && !is_null(ctx, arg[0])) {
+    printf("lambda: parameter 1 must be a pair or sym\n");
+    return analyze_error(ctx);
+  }
+  scope_t inner = {scope, NULL, 0, 0, 0};
+  int nparams = 0;
+  cell_t *params;
+  for (params = arg[0]; is_pair(params); params = _cdr(params)) {
+    if (!is_sym(_car(params))) {
+      printf("ERROR: lambda: parameter name must be a symbol\n");
+      free(inner.names);
+      return analyze_error(ctx);
+    }
+    scope_add(&inner, _car(params));
+    ++nparams;
+  }
+  int rest = is_sym(params);
+  if (rest) {
+    scope_add(&inner, params);
+  }
+  cell_t *proc = analyze_proc(ctx, &inner, nparams, rest, arg[1]);
+  cell_t *node = mk_node(ctx, &node_lambda, 1);
+  node_slots(node)[0] = proc;
+  return node;
+}
+
+/* (macro (name arg) body) */
+static cell_t *analyze_macro(scheme_ctx_t *ctx, cell_t *args, scope_t *scope)
+{
+  if (list_length(args) != 2) {
+    printf("ERROR: macro needs 2 arguments\n");
+    return analyze_error(ctx);
+  }
+  cell_t *arg0 = _car(args); /* name + arg */
+  if (list_length(arg0) != 2) {
+    printf("ERROR: macro illegal parameter 1, must be pair with 2 elements\n");
+    return analyze_error(ctx);
+  }
+  cell_t *macro_name = _car(arg0);
+  cell_t *macro_arg = _car(_cdr(arg0));
+  if (!is_sym(macro_name)) {
+    printf("ERROR: macro name must be a symbol\n");
+    return analyze_error(ctx);
+  } else if(!is_sym(macro_arg)) {
+    printf("ERROR: macro argument must be a symbol\n");
+    return analyze_error(ctx);
+  }
+  int index = define_index(ctx, macro_name, scope);
+  if (index < -1) {
+    return analyze_error(ctx);
+  }
+  scope_t inner = {scope, NULL, 0, 0, 0};
+  scope_add(&inner, macro_arg);
+  cell_t *proc = analyze_proc(ctx, &inner, 1, 0, _car(_cdr(args)));
+  cell_t *node = mk_node(ctx, &node_macro, 1);
+  node_slots(node)[0] = proc;
+  return analyze_definition(ctx, macro_name, index, node);
+}
+
+/* Compiles a form into a tree of nodes, each of which evaluates itself
+ * through its exec function. The syntax of special forms is checked and
+ * variables are looked up here, once, and the macros known by now are
+ * expanded, so running the nodes does no syntactic work. */
+cell_t *analyze(scheme_ctx_t *ctx, cell_t *obj, scope_t *scope)
+{
+  if (is_sym(obj)) {
+    return analyze_symbol(ctx, obj, scope);
+  } else if (is_null(ctx, obj)) {
+    printf("error try to apply NULL\n");
+    return analyze_error(ctx);
+  } else if (!is_pair(obj)) {
+    return analyze_const(ctx, obj);
+  }
+  cell_t *cmd = _car(obj);
+  cell_t *args = _cdr(obj);
+  size_t base = ctx->roots_pos;
+  if (cmd == ctx->SYMBOL_QUOTE) {
+    return analyze_const(ctx, is_pair(args) ? _car(args) : ctx->NIL);
+  } else if (cmd == ctx->SYMBOL_QUASIQUOTE) {
+    cell_t *template = analyze_quasiquote(ctx, args, scope);
+    cell_t *node = mk_node(ctx, &node_quasiquote, 1);
+    node_slots(node)[0] = template;
+    return node;
+  } else if (cmd == ctx->SYMBOL_LAMBDA) {
+    return analyze_lambda(ctx, args, scope);
+  } else if (cmd == ctx->SYMBOL_MACRO) {
+    return analyze_macro(ctx, args, scope);
+  } else if (cmd == ctx->SYMBOL_DEFINE) {
+    if (list_length(args) != 2) {
+      printf("ERROR: 'define' requites 2 arguments\n");
+      return analyze_error(ctx);
+    } else if (!is_sym(_car(args))) {
+      printf("ERROR: define: name is not a symbol\n");
+      return analyze_error(ctx);
+    }
+    int index = define_index(ctx, _car(args), scope);
+    if (index < -1) {
+      return analyze_error(ctx);
+    }
+    cell_t *value = analyze(ctx, _car(_cdr(args)), scope);
+    return analyze_definition(ctx, _car(args), index, value);
+  } else if (cmd == ctx->SYMBOL_IF) {
+    /* (if a b c) */
+    if (list_length(args) != 3) {
+      printf("ERROR: 'if' requires 3 arguments\n");
+      return analyze_error(ctx);
+    }
+    analyze_onto_roots(ctx, args, scope);
+    return mk_node_from_roots(ctx, &node_if, 0, base, 3);
+  } else if (cmd == ctx->SYMBOL_BEGIN) {
+    int n = analyze_onto_roots(ctx, args, scope);
+    if (!n) {
+      return analyze_const(ctx, ctx->NIL);
+    }
+    return mk_node_from_roots(ctx, &node_begin, 0, base, n);
+  }
+  node_fn exec = &node_call;
+  if (is_sym(cmd) && !scope_binds(scope, cmd)) {
+    cell_t *macro = env_lookup(ctx, cmd);
+    if (macro && is_macro(macro)) {
+      return analyze(ctx, macro_expand(ctx, macro, obj), scope);
+    }
+    exec = &node_call_global;
+    push_root(ctx, cmd);
+  } else {
+    analyze_push(ctx, cmd, scope);
   }
-  return arg[0]->u.integer <= arg[1]->u.integer ? ctx->TRUE : ctx->FALSE;
+  /* the source form is kept for error messages and for macros that are
+   * defined after the call was analyzed, see expand_call() */
+  int n = analyze_onto_roots(ctx, args, scope);
+  cell_t *node = mk_node_from_roots(ctx, exec, 2, base, n + 1);
+  node_slots(node)[0] = obj;
+  node_slots(node)[1] = ctx->NIL;
+  return node;
 }
 
-cell_t *write_primop(scheme_ctx_t *ctx, cell_t *args)
+/* analyze code that runs in the current frame */
+static cell_t *analyze_in_frame(scheme_ctx_t *ctx, cell_t *obj)
 {
-  cell_t *arg_array[1];
-  int arg_types[] = {CELL_T_EMPTY};
-  if (!get_args(args, 1, arg_types, arg_array)) {
-    print_obj(ctx, arg_array[0]);
+  int depth = 0;
+  for (cell_t *f = ctx->frame; !is_null(ctx, f);
+      f = record_slots(f)[FRAME_PARENT]) {
+    ++depth;
   }
-  return ctx->NIL;
-}
-
-cell_t *display(scheme_ctx_t *ctx, cell_t *args)
-{
-  cell_t *arg_array[1];
-  int arg_types[] = {CELL_T_EMPTY};
-  if (!get_args(args, 1, arg_types, arg_array)) {
-    if (arg_array[0]->type == CELL_T_STRING) {
-      printf("%s", arg_array[0]->u.string);
-    } else {
-      print_obj(ctx, arg_array[0]);
+  if (!depth) {
+    return analyze(ctx, obj, NULL);
+  }
+  scope_t *scopes = calloc(depth, sizeof(scope_t));
+  cell_t *f = ctx->frame;
+  for (int i = 0; i < depth; ++i) {
+    scopes[i].parent = i + 1 < depth ? &scopes[i + 1] : NULL;
+    scopes[i].fixed = 1;
+    for (cell_t *n = record_slots(f)[FRAME_NAMES]; is_pair(n); n = _cdr(n)) {
+      scope_add(&scopes[i], _car(n));
     }
+    f = record_slots(f)[FRAME_PARENT];
   }
-  return ctx->NIL;
+  cell_t *ret = analyze(ctx, obj, scopes);
+  for (int i = 0; i < depth; ++i) {
+    free(scopes[i].names);
+  }
+  free(scopes);
+  return ret;
 }
 
-cell_t *newline(scheme_ctx_t *ctx, cell_t *args)
+cell_t *eval_primop(scheme_ctx_t *ctx, cell_t **args, int n)
 {
-  printf("\n");
-  return ctx->NIL;
+  /* evaluates in the global environment */
+  cell_t *frame = push_root(ctx, ctx->frame);
+  ctx->frame = ctx->NIL;
+  cell_t *ret = eval(ctx, analyze(ctx, args[0], NULL));
+  ctx->frame = frame;
+  return ret;
 }
 
-cell_t *flush_output(scheme_ctx_t *ctx, cell_t *args)
-{
-  /* ignore args for now */
-  fflush(stdout);
-  return ctx->NIL;
-}
+/* -------------------------------- bytecode -------------------------------- */
+
+/* With the vm engine the body of every lambda is compiled from its nodes
+ * into bytecode, kept in a code record: opcodes and small operands are
+ * fixnums, constants are stored in the code itself. The vm runs it on the
+ * root stack, which holds the operands and, for every call, the state of
+ * the caller, so calls between compiled lambdas do not recurse in C. */
+enum vm_op_e {
+  OP_CONST, OP_GLOBAL, OP_LOCAL0, OP_LOCAL, OP_DEFINE_GLOBAL, OP_DEFINE_LOCAL,
+  OP_POP, OP_JUMP, OP_JUMP_IF_FALSE, OP_CLOSURE, OP_MACRO, OP_QUASIQUOTE,
+  OP_CALLEE_GLOBAL, OP_CALLEE_LOCAL, OP_CALLEE_CHECK, OP_CALL, OP_TAIL_CALL,
+  OP_RETURN, OP_FOLDED,
+  /* a node_if_folded: epoch, where to go once it is out of date */
+  OP_GUARD,
+  /* a node_flonum tree over the values of its n leaves on the stack: node,
+   * n */
+  OP_FLONUM,
+  /* inlined builtins (node_prim), in the order of enum prim_e: symbol,
+   * source. The fast path is only taken while the symbol still holds the
+   * primop and the arguments have the right type. */
+  OP_ADD, OP_SUB, OP_MUL, OP_MODULO, OP_NUM_EQ, OP_LT, OP_GT, OP_LT_EQ,
+  OP_GT_EQ, OP_EQ, OP_CONS, OP_CAR, OP_CDR,
+  /* an if testing a comparison: symbol, source, where to go if false */
+  OP_BRANCH_NUM_EQ, OP_BRANCH_LT, OP_BRANCH_GT, OP_BRANCH_LT_EQ,
+  OP_BRANCH_GT_EQ, OP_BRANCH_EQ,
+  OP_COUNT
+};
 
-cell_t *eq(scheme_ctx_t *ctx, cell_t *args)
+/* name, number of operands, change of the stack depth (calls take another
+ * n off) */
+static struct {
+  char *name;
+  int operands;
+  int stack;
+} vm_ops[OP_COUNT] = {
+  [OP_CONST] = {"const", 1, 1},
+  [OP_GLOBAL] = {"global", 1, 1},
+  [OP_LOCAL0] = {"local0", 1, 1},
+  [OP_LOCAL] = {"local", 2, 1},
+  [OP_DEFINE_GLOBAL] = {"define-global", 1, 0},
+  [OP_DEFINE_LOCAL] = {"define-local", 2, 0},
+  [OP_POP] = {"pop", 0, -1},
+  [OP_JUMP] = {"jump", 1, 0},
+  [OP_JUMP_IF_FALSE] = {"jump-if-false", 1, -1},
+  [OP_CLOSURE] = {"closure", 1, 1},
+  [OP_MACRO] = {"macro", 1, 1},
+  [OP_QUASIQUOTE] = {"quasiquote", 1, 1},
+  [OP_CALLEE_GLOBAL] = {"callee-global", 3, 1},
+  [OP_CALLEE_LOCAL] = {"callee-local", 4, 1},
+  [OP_CALLEE_CHECK] = {"callee-check", 2, 0},
+  [OP_CALL] = {"call", 2, 0},
+  [OP_TAIL_CALL] = {"tail-call", 2, 0},
+  [OP_RETURN] = {"return", 0, 0},
+  [OP_FOLDED] = {"folded", 3, 0},
+  [OP_GUARD] = {"guard", 2, 0},
+  [OP_FLONUM] = {"flonum", 2, 1},
+  [OP_ADD] = {"add", 2, -1},
+  [OP_SUB] = {"sub", 2, -1},
+  [OP_MUL] = {"mul", 2, -1},
+  [OP_MODULO] = {"modulo", 2, -1},
+  [OP_NUM_EQ] = {"num-eq", 2, -1},
+  [OP_LT] = {"lt", 2, -1},
+  [OP_GT] = {"gt", 2, -1},
+  [OP_LT_EQ] = {"lt-eq", 2, -1},
+  [OP_GT_EQ] = {"gt-eq", 2, -1},
+  [OP_EQ] = {"eq", 2, -1},
+  [OP_CONS] = {"cons", 2, -1},
+  [OP_CAR] = {"car", 2, 0},
+  [OP_CDR] = {"cdr", 2, 0},
+  [OP_BRANCH_NUM_EQ] = {"branch-num-eq", 3, -2},
+  [OP_BRANCH_LT] = {"branch-lt", 3, -2},
+  [OP_BRANCH_GT] = {"branch-gt", 3, -2},
+  [OP_BRANCH_LT_EQ] = {"branch-lt-eq", 3, -2},
+  [OP_BRANCH_GT_EQ] = {"branch-gt-eq", 3, -2},
+  [OP_BRANCH_EQ] = {"branch-eq", 3, -2},
+};
+
+typedef struct code_buf_s {
+  cell_t **code;
+  size_t len;
+  size_t size;
+  int depth;
+  int max_depth;
+} code_buf_t;
+
+static size_t emit(code_buf_t *buf, cell_t *word)
 {
-  cell_t *arg[2];
-  int arg_types[2] = {CELL_T_EMPTY, CELL_T_EMPTY};
-  if (get_args(args, 2, arg_types, arg)) {
-    return ctx->FALSE;
+  if (buf->len >= buf->size) {
+    buf->size = buf->size ? buf->size * 2 : 64;
+    buf->code = realloc(buf->code, sizeof(cell_t *) * buf->size);
   }
-  return (arg[0] == arg[1]) ? ctx->TRUE : ctx->FALSE;
+  buf->code[buf->len] = word;
+  return buf->len++;
 }
 
-cell_t *integer_eq(scheme_ctx_t *ctx, cell_t *args)
+static size_t emit_op(code_buf_t *buf, int op)
 {
-  cell_t *arg[2];
-  int types[2] = {CELL_T_INTEGER, CELL_T_INTEGER};
-  if (get_args(args, 2, types, arg)) {
-    return ctx->NIL;
+  buf->depth += vm_ops[op].stack;
+  if (buf->depth > buf->max_depth) {
+    buf->max_depth = buf->depth;
   }
-  return arg[0]->u.integer == arg[1]->u.integer ? ctx->TRUE : ctx->FALSE;
+  return emit(buf, mk_fixnum(op));
 }
 
-cell_t *modulo(scheme_ctx_t *ctx, cell_t *args)
+/* fill in the jump target left open at 'at' */
+#define patch(buf, at, target) ((buf)->code[at] = mk_fixnum(target))
+
+static int compile_node(scheme_ctx_t *ctx, code_buf_t *buf, cell_t *node,
+    int tail);
+
+static int compile_call(scheme_ctx_t *ctx, code_buf_t *buf, cell_t *node,
+    int tail)
 {
-  cell_t *arg[2];
-  int types[2] = {CELL_T_INTEGER, CELL_T_INTEGER};
-  if (get_args(args, 2, types, arg)) {
-    return ctx->NIL;
+  cell_t **slots = node_slots(node);
+  int n = node_size(node) - 3;
+  size_t skip;
+  if (node->u.record.exec == &node_call_global) {
+    emit_op(buf, OP_CALLEE_GLOBAL);
+    emit(buf, slots[2]);
+  } else if (slots[2]->u.record.exec == &node_local0
+      || slots[2]->u.record.exec == &node_local) {
+    cell_t **local = node_slots(slots[2]);
+    emit_op(buf, OP_CALLEE_LOCAL);
+    emit(buf, local[1]);
+    emit(buf, local[2]);
+  } else {
+    if (compile_node(ctx, buf, slots[2], 0)) {
+      return -1;
+    }
+    emit_op(buf, OP_CALLEE_CHECK);
+  }
+  /* where to go on when the callee turned out to be a macro, and the node
+   * that keeps its expansion */
+  skip = emit(buf, ctx->NIL);
+  emit(buf, node);
+  for (int j = 0; j < n; ++j) {
+    if (compile_node(ctx, buf, slots[3 + j], 0)) {
+      return -1;
+    }
   }
-  return mk_integer(ctx, arg[0]->u.integer % arg[1]->u.integer);
+  emit_op(buf, tail ? OP_TAIL_CALL : OP_CALL);
+  buf->depth -= n;
+  emit(buf, mk_fixnum(n));
+  emit(buf, slots[0]);
+  patch(buf, skip, buf->len);
+  if (tail) {
+    emit_op(buf, OP_RETURN);
+  }
+  return 0;
 }
 
-cell_t *eqv(scheme_ctx_t *ctx, cell_t *args)
+/* the arguments of an inlined builtin and its opcode, base is OP_ADD or
+ * OP_BRANCH_NUM_EQ */
+static int compile_prim(scheme_ctx_t *ctx, code_buf_t *buf, cell_t *node,
+    int base)
 {
-  return ctx->FALSE;
+  cell_t **slots = node_slots(node);
+  int prim = fixnum_value(slots[1]);
+  for (int i = 0; i < prims[prim].nargs; ++i) {
+    if (compile_node(ctx, buf, slots[2 + i], 0)) {
+      return -1;
+    }
+  }
+  emit_op(buf, base == OP_ADD ? OP_ADD + prim : base + prim - PRIM_NUM_EQ);
+  emit(buf, node_slots(slots[0])[2]);
+  emit(buf, node_slots(slots[0])[0]);
+  return 0;
 }
 
-cell_t *apply_primop(scheme_ctx_t *ctx, cell_t *primop, cell_t *args)
+/* the leaves of a node_flonum tree, returns their number or -1 */
+static int compile_flonum_leaves(scheme_ctx_t *ctx, code_buf_t *buf,
+    cell_t *node)
 {
-  return primop->u.primop(ctx, args);
+  cell_t **slots = node_slots(node);
+  int n = 0;
+  for (int j = 0; j < flop_of(node).nargs; ++j) {
+    int leaves = 1;
+    if (is_flonum_op(slots[2 + j])) {
+      leaves = compile_flonum_leaves(ctx, buf, slots[2 + j]);
+    } else if (compile_node(ctx, buf, slots[2 + j], 0)) {
+      leaves = -1;
+    }
+    if (leaves < 0) {
+      return -1;
+    }
+    n += leaves;
+  }
+  return n;
 }
 
-cell_t *primop_length(scheme_ctx_t *ctx, cell_t *args)
+/* The two ways an if or a guard goes on: the code for 'then' follows, the
+ * jump operand at 'jump' is patched to go to the code for 'otherwise'. */
+static int compile_branches(scheme_ctx_t *ctx, code_buf_t *buf, size_t jump,
+    cell_t *then, cell_t *otherwise, int tail)
 {
-  int ret = 0;
-  cell_t *arg[1];
-  int types[1] = {CELL_T_EMPTY};
-  if (get_args(args, 1, types, arg)) {
-    return ctx->NIL;
+  int depth = buf->depth;
+  if (compile_node(ctx, buf, then, tail)) {
+    return -1;
   }
-  for(cell_t *c = arg[0]; is_pair(c); c = _cdr(c)) {
-    ++ret;
+  size_t end = 0;
+  if (!tail) {
+    emit_op(buf, OP_JUMP);
+    end = emit(buf, ctx->NIL);
   }
-  return mk_integer(ctx, ret);
+  patch(buf, jump, buf->len);
+  buf->depth = depth;
+  if (compile_node(ctx, buf, otherwise, tail)) {
+    return -1;
+  }
+  if (!tail) {
+    patch(buf, end, buf->len);
+  }
+  return 0;
 }
 
-cell_t *primop_cons(scheme_ctx_t *ctx, cell_t *args)
+/* Appends the code for node. In tail position the code returns its value,
+ * otherwise it leaves it on the stack. */
+static int compile_node(scheme_ctx_t *ctx, code_buf_t *buf, cell_t *node,
+    int tail)
 {
-  cell_t *arg[2];
-  int types[2] = {CELL_T_EMPTY, CELL_T_EMPTY};
-  if (get_args(args, 2, types, arg)) {
-    return ctx->NIL;
+  node_fn exec = node->u.record.exec;
+  cell_t **slots = node_slots(node);
+  if (exec == &node_call || exec == &node_call_global) {
+    return compile_call(ctx, buf, node, tail);
+  } else if (exec == &node_folded) {
+    emit_op(buf, OP_FOLDED);
+    emit(buf, slots[0]);
+    emit(buf, slots[1]);
+    size_t done = emit(buf, ctx->NIL);
+    if (compile_node(ctx, buf, slots[2], tail)) {
+      return -1;
+    }
+    patch(buf, done, buf->len);
+    if (tail) {
+      emit_op(buf, OP_RETURN);
+    }
+    return 0;
+  } else if (exec == &node_if) {
+    cell_t *test = slots[0];
+    if (test->u.record.exec == &node_prim
+        && is_comparison(fixnum_value(node_slots(test)[1]))) {
+      /* compare and jump in one */
+      if (compile_prim(ctx, buf, test, OP_BRANCH_NUM_EQ)) {
+        return -1;
+      }
+    } else {
+      if (compile_node(ctx, buf, test, 0)) {
+        return -1;
+      }
+      emit_op(buf, OP_JUMP_IF_FALSE);
+    }
+    return compile_branches(ctx, buf, emit(buf, ctx->NIL), slots[1],
+        slots[2], tail);
+  } else if (exec == &node_if_folded) {
+    emit_op(buf, OP_GUARD);
+    emit(buf, slots[1]);
+    return compile_branches(ctx, buf, emit(buf, ctx->NIL), slots[0],
+        slots[2], tail);
+  } else if (exec == &node_begin) {
+    size_t last = node_size(node) - 1;
+    for (size_t i = 0; i < last; ++i) {
+      if (compile_node(ctx, buf, slots[i], 0)) {
+        return -1;
+      }
+      emit_op(buf, OP_POP);
+    }
+    return compile_node(ctx, buf, slots[last], tail);
   }
-  return cons(ctx, arg[0], arg[1]);
-}
 
-/* environment hanlding */
+  if (exec == &node_prim) {
+    if (compile_prim(ctx, buf, node, OP_ADD)) {
+      return -1;
+    }
+  } else if (exec == &node_flonum) {
+    int n = compile_flonum_leaves(ctx, buf, node);
+    if (n < 0) {
+      return -1;
+    }
+    emit_op(buf, OP_FLONUM);
+    buf->depth -= n;
+    emit(buf, node);
+    emit(buf, mk_fixnum(n));
+  } else if (exec == &node_const) {
+    emit_op(buf, OP_CONST);
+    emit(buf, slots[0]);
+  } else if (exec == &node_global) {
+    emit_op(buf, OP_GLOBAL);
+    emit(buf, slots[0]);
+  } else if (exec == &node_local0) {
+    emit_op(buf, OP_LOCAL0);
+    emit(buf, slots[2]);
+  } else if (exec == &node_local) {
+    emit_op(buf, OP_LOCAL);
+    emit(buf, slots[1]);
+    emit(buf, slots[2]);
+  } else if (exec == &node_define_global) {
+    if (compile_node(ctx, buf, slots[3], 0)) {
+      return -1;
+    }
+    emit_op(buf, OP_DEFINE_GLOBAL);
+    emit(buf, slots[0]);
+  } else if (exec == &node_define_local) {
+    if (compile_node(ctx, buf, slots[3], 0)) {
+      return -1;
+    }
+    emit_op(buf, OP_DEFINE_LOCAL);
+    emit(buf, slots[1]);
+    emit(buf, slots[2]);
+  } else if (exec == &node_lambda) {
+    emit_op(buf, OP_CLOSURE);
+    emit(buf, slots[0]);
+  } else if (exec == &node_macro) {
+    emit_op(buf, OP_MACRO);
+    emit(buf, slots[0]);
+  } else if (exec == &node_quasiquote) {
+    emit_op(buf, OP_QUASIQUOTE);
+    emit(buf, slots[0]);
+  } else {
+    return -1;
+  }
+  if (tail) {
+    emit_op(buf, OP_RETURN);
+  }
+  return 0;
+}
 
-cell_t *env_define(scheme_ctx_t *ctx, cell_t *symbol, cell_t *value)
+/* bytecode for the body of a proc, NULL if it cannot be compiled; the first
+ * slot holds the most stack slots the code needs */
+static cell_t *compile(scheme_ctx_t *ctx, cell_t *body)
 {
-  ctx->env = cons(ctx, cons(ctx, symbol, cons(ctx, value, ctx->NIL)), ctx->env);
-  return value;
+  code_buf_t buf = {NULL, 0, 0, 0, 0};
+  cell_t *ret = NULL;
+  emit(&buf, ctx->NIL);
+  if (!compile_node(ctx, &buf, body, 1)
+      && record_cells(buf.len) <= SEGMENT_CELLS / 2) {
+    buf.code[0] = mk_fixnum(buf.max_depth);
+    ret = mk_record(ctx, CELL_T_CODE, buf.len);
+    memcpy(record_slots(ret), buf.code, sizeof(cell_t *) * buf.len);
+  }
+  free(buf.code);
+  return ret;
 }
 
-cell_t *env_resolve(scheme_ctx_t *ctx, cell_t *symbol)
+static void disassemble_code(scheme_ctx_t *ctx, cell_t *code)
 {
-  for (cell_t *e = ctx->env; !is_null(ctx, e); e = _cdr(e)) {
-    if (symbol == _car(_car(e))) {
-      return _car(_cdr(_car(e)));
+  cell_t **slots = record_slots(code);
+  printf("       stack %d\n", (int)fixnum_value(slots[0]));
+  for (size_t pc = 1; pc < code->u.record.size; ) {
+    int op = fixnum_value(slots[pc]);
+    printf("%5zu  %-14s", pc, vm_ops[op].name);
+    for (int i = 1; i <= vm_ops[op].operands; ++i) {
+      cell_t *operand = slots[pc + i];
+      printf(" ");
+      /* nodes are shown by the source of their call */
+      if (cell_type(operand) == CELL_T_NODE
+          && operand->u.record.exec == &node_flonum) {
+        operand = node_slots(operand)[0];
+      }
+      print_obj(ctx, cell_type(operand) == CELL_T_NODE
+          ? node_slots(operand)[0] : operand);
     }
+    printf("\n");
+    pc += 1 + vm_ops[op].operands;
   }
-  printf("ERROR: symbol '%s' is not defined\n", symbol->u.symbol);
-  return ctx->NIL; /* symbol not found in environment */
 }
 
-/* eval */
-
-cell_t *eval(scheme_ctx_t *ctx, cell_t *obj);
-
-cell_t *eval_primop(scheme_ctx_t *ctx, cell_t *obj)
+cell_t *disassemble(scheme_ctx_t *ctx, cell_t **args, int n)
 {
-  if (list_length( obj )!= 1) {
-    printf("eval only has/needs one argument\n");
+  if (!is_lambda(args[0]) && !is_macro(args[0])) {
+    printf("ERROR: disassemble: lambda or macro expected %s given\n",
+        get_type_name(cell_type(args[0])));
+    return ctx->NIL;
+  }
+  cell_t *code = record_slots(args[0]->u.lambda.proc)[PROC_CODE];
+  if (is_null(ctx, code)) {
+    printf("ERROR: disassemble: no bytecode, not run by the vm engine\n");
     return ctx->NIL;
   }
-  return eval(ctx, _car(obj));
+  disassemble_code(ctx, code);
+  return ctx->NIL;
 }
 
-cell_t *eval_list(scheme_ctx_t *ctx, cell_t *list)
+/* a macro found in the callee position of the call node when the code
+ * runs */
+static cell_t *vm_expand(scheme_ctx_t *ctx, cell_t *macro, cell_t *node)
 {
-  if (ctx->NIL == list) {
-    return ctx->NIL;
-  }
-  /* XXX the result of eval is not in sink ... only in ctx->result but
-   * this will be overwritten by any other eval */
-  return cons(ctx, add_to_sink(ctx, eval(ctx, _car(list))), eval_list(ctx, _cdr(list)));
+  return eval_node(ctx, expand_call(ctx, node, macro), NULL);
 }
 
-cell_t *eval_quasiquote(scheme_ctx_t *ctx, cell_t *list)
+/* call the value of a global with the n values on top of the stack, for
+ * the inlined builtins when they cannot take the fast path */
+static void vm_call_global(scheme_ctx_t *ctx, cell_t *symbol, int n,
+    cell_t *source)
 {
-  if (!is_pair(list)) {
-    return list;
-  }
-  cell_t *obj;
-  if (ctx->SYMBOL_UNQUOTE == _car(list)) {
-    return eval (ctx, _car(_cdr(list)));
-  } else if (is_pair(_car(list))) {
-      if (ctx->SYMBOL_UNQUOTE == _car(_car(list))) {
-        obj = eval(ctx, _car(_cdr(_car(list))));
-      } else if (ctx->SYMBOL_UNQUOTE_SPLICE == _car(_car(list))) {
-        obj = eval_list(ctx, _cdr(_car(list)));
-        return _car(obj);
-      } else {
-        obj = eval_quasiquote(ctx, _car(list));
-      }
-  } else {
-    obj = _car(list);
+  size_t base = ctx->roots_pos - n;
+  cell_t *fn = push_root(ctx, env_resolve(ctx, symbol));
+  cell_t *ret = apply_values(ctx, fn, base, n, source);
+  ctx->roots_pos = base;
+  push_root(ctx, ret);
+}
+
+/* store the n arguments on the stack from base on in the frame, clear the
+ * slots of its internal defines */
+static void vm_reuse_frame(scheme_ctx_t *ctx, cell_t *frame, size_t base,
+    int n)
+{
+  cell_t **slots = record_slots(frame);
+  size_t size = frame->u.record.size;
+  for (size_t i = FRAME_SLOTS; i < size; ++i) {
+    cell_t *value = i - FRAME_SLOTS < (size_t)n
+        ? ctx->roots[base + i - FRAME_SLOTS] : ctx->NIL;
+    gc_write_barrier(ctx, frame, slots[i], value);
+    slots[i] = value;
   }
-  return (cons(ctx, add_to_sink(ctx, obj), eval_quasiquote(ctx, _cdr(list))));
 }
 
-cell_t *apply_macro( scheme_ctx_t *ctx, cell_t *macro, cell_t *args)
+/* The state of a caller is saved in four stack slots below the operands of
+ * the callee: its frame, its pc, its fp; the last one holds the lambda
+ * running in the callee, which keeps its code alive. fp points above
+ * them. */
+#define VM_SAVED 4
+
+/* Runs a compiled lambda with its frame. A tail call from it to a lambda
+ * that is not compiled is handed back in tail. */
+static cell_t *vm_run(scheme_ctx_t *ctx, cell_t *lambda, cell_t *frame,
+    tail_t *tail)
 {
-  cell_t *old_env = ctx->env;
+  static void *labels[OP_COUNT] = {
+    [OP_CONST] = &&op_const,
+    [OP_GLOBAL] = &&op_global,
+    [OP_LOCAL0] = &&op_local0,
+    [OP_LOCAL] = &&op_local,
+    [OP_DEFINE_GLOBAL] = &&op_define_global,
+    [OP_DEFINE_LOCAL] = &&op_define_local,
+    [OP_POP] = &&op_pop,
+    [OP_JUMP] = &&op_jump,
+    [OP_JUMP_IF_FALSE] = &&op_jump_if_false,
+    [OP_CLOSURE] = &&op_closure,
+    [OP_MACRO] = &&op_macro,
+    [OP_QUASIQUOTE] = &&op_quasiquote,
+    [OP_CALLEE_GLOBAL] = &&op_callee_global,
+    [OP_CALLEE_LOCAL] = &&op_callee_local,
+    [OP_CALLEE_CHECK] = &&op_callee_check,
+    [OP_CALL] = &&op_call,
+    [OP_TAIL_CALL] = &&op_tail_call,
+    [OP_RETURN] = &&op_return,
+    [OP_FOLDED] = &&op_folded,
+    [OP_GUARD] = &&op_guard,
+    [OP_FLONUM] = &&op_flonum,
+    [OP_ADD] = &&op_add,
+    [OP_SUB] = &&op_sub,
+    [OP_MUL] = &&op_mul,
+    [OP_MODULO] = &&op_modulo,
+    [OP_NUM_EQ] = &&op_num_eq,
+    [OP_LT] = &&op_lt,
+    [OP_GT] = &&op_gt,
+    [OP_LT_EQ] = &&op_lt_eq,
+    [OP_GT_EQ] = &&op_gt_eq,
+    [OP_EQ] = &&op_eq,
+    [OP_CONS] = &&op_cons,
+    [OP_CAR] = &&op_car,
+    [OP_CDR] = &&op_cdr,
+    [OP_BRANCH_NUM_EQ] = &&op_branch_num_eq,
+    [OP_BRANCH_LT] = &&op_branch_lt,
+    [OP_BRANCH_GT] = &&op_branch_gt,
+    [OP_BRANCH_LT_EQ] = &&op_branch_lt_eq,
+    [OP_BRANCH_GT_EQ] = &&op_branch_gt_eq,
+    [OP_BRANCH_EQ] = &&op_branch_eq,
+  };
+  cell_t **code;
+  cell_t **pc;
+  cell_t **sp;
+  cell_t *fn;
+  cell_t *a;
+  size_t fp;
+  size_t entry;
+  size_t base;
+  int n;
+  intptr_t z;
+  int in_tail;
 
-  env_define(ctx, macro->u.macro.arg_name, args);
-  cell_t *ret = eval(ctx, eval(ctx, macro->u.macro.body));
+/* sp is kept in a register; it is written back to ctx->roots_pos before
+ * anything that can allocate or push, and read again afterwards as the
+ * stack can move when it grows */
+#define NEXT goto *labels[fixnum_value(*pc++)]
+#define SYNC() (ctx->roots_pos = sp - ctx->roots)
+#define RELOAD() (sp = ctx->roots + ctx->roots_pos)
+#define STACK(i) (ctx->roots[i])
+#define TOP (sp[-1])
+#define PUSH(v) (*sp++ = (v))
+/* push what an allocating expression returns, without its temporaries */
+#define PUSH_NEW(expr) do { \
+    size_t sp_ = SYNC(); \
+    cell_t *v_ = (expr); \
+    sp = ctx->roots + sp_; \
+    PUSH(v_); \
+  } while (0)
+/* the code checks only here that the stack has room for its operands */
+#define ENTER(lambda) do { \
+    code = proc_code(lambda); \
+    pc = code + 1; \
+    if ((size_t)(sp - ctx->roots) + fixnum_value(code[0]) + VM_SAVED \
+        > ctx->roots_size) { \
+      SYNC(); \
+      while (ctx->roots_pos + fixnum_value(code[0]) + VM_SAVED \
+          > ctx->roots_size) { \
+        roots_grow(ctx); \
+      } \
+      RELOAD(); \
+    } \
+  } while (0)
+#define BUILTIN(prim) is_builtin(pc[0]->u.symbol.value, prim)
+#define SLOW(n) do { \
+    SYNC(); \
+    vm_call_global(ctx, pc[0], n, pc[1]); \
+    RELOAD(); \
+    pc += 2; \
+    NEXT; \
+  } while (0)
+#define BRANCH_OP(prim, types, cond) \
+  if ((types) && BUILTIN(prim)) { \
+    intptr_t x = fixnum_value(sp[-2]); \
+    intptr_t y = fixnum_value(TOP); \
+    (void)x; \
+    (void)y; \
+    sp -= 2; \
+    pc = (cond) ? pc + 3 : code + fixnum_value(pc[2]); \
+    NEXT; \
+  } \
+  goto branch_slow;
+#define OVERFLOW_OP(prim, overflow) \
+  if (is_fixnum(sp[-2]) && is_fixnum(TOP) && BUILTIN(prim) \
+      && !overflow(fixnum_value(sp[-2]), fixnum_value(TOP), &z)) { \
+    sp -= 1; \
+    TOP = mk_fixnum(z); \
+    pc += 2; \
+    NEXT; \
+  } \
+  SLOW(2);
+#define FIXNUM_OP(op, expr) \
+  if (is_fixnum(sp[-2]) && is_fixnum(TOP) && BUILTIN(op)) { \
+    intptr_t x = fixnum_value(sp[-2]); \
+    intptr_t y = fixnum_value(TOP); \
+    sp -= 1; \
+    TOP = (expr); \
+    pc += 2; \
+    NEXT; \
+  } \
+  SLOW(2);
 
-  ctx->env = old_env;
+  push_root(ctx, ctx->frame);
+  push_root(ctx, mk_fixnum(0));
+  push_root(ctx, mk_fixnum(0));
+  push_root(ctx, lambda);
+  entry = fp = ctx->roots_pos;
+  ctx->frame = frame;
+  RELOAD();
+  ENTER(lambda);
+  NEXT;
 
-  return ret;
-}
+op_const:
+  PUSH(pc[0]);
+  pc += 1;
+  NEXT;
+op_global:
+  PUSH(env_resolve(ctx, pc[0]));
+  pc += 1;
+  NEXT;
+op_local0:
+  PUSH(record_slots(ctx->frame)[FRAME_SLOTS + fixnum_value(pc[0])]);
+  pc += 1;
+  NEXT;
+op_local:
+  PUSH(record_slots(frame_up(ctx, fixnum_value(pc[0])))
+      [FRAME_SLOTS + fixnum_value(pc[1])]);
+  pc += 2;
+  NEXT;
+op_define_global:
+  env_define(ctx, pc[0], TOP);
+  pc += 1;
+  NEXT;
+op_define_local:
+  local_set(ctx, fixnum_value(pc[0]), fixnum_value(pc[1]), TOP);
+  pc += 2;
+  NEXT;
+op_pop:
+  sp -= 1;
+  NEXT;
+op_jump:
+  pc = code + fixnum_value(pc[0]);
+  NEXT;
+op_jump_if_false:
+  sp -= 1;
+  pc = is_false(ctx, *sp) ? code + fixnum_value(pc[0]) : pc + 1;
+  NEXT;
+op_closure:
+  PUSH_NEW(mk_lambda(ctx, pc[0]));
+  pc += 1;
+  NEXT;
+op_macro:
+  PUSH_NEW(mk_macro(ctx, pc[0]));
+  pc += 1;
+  NEXT;
+op_quasiquote:
+  PUSH_NEW(eval_quasiquote(ctx, pc[0]));
+  pc += 1;
+  NEXT;
 
-cell_t *apply_lambda(
-    scheme_ctx_t *ctx,
-    cell_t *lambda,
-    cell_t *args,
-    cell_t *last_lambda,
-    cell_t **tail_recursion_args);
+  /* the callee ops check for macros before the arguments are evaluated:
+   * symbol | depth index | -, then where to go on and the call node */
+op_callee_global:
+  fn = env_resolve(ctx, pc[0]);
+  pc += 1;
+  goto callee;
+op_callee_local:
+  fn = record_slots(frame_up(ctx, fixnum_value(pc[0])))
+      [FRAME_SLOTS + fixnum_value(pc[1])];
+  pc += 2;
+  goto callee;
+op_callee_check:
+  sp -= 1;
+  fn = *sp;
+callee:
+  if (is_macro(fn)) {
+    PUSH_NEW(vm_expand(ctx, fn, pc[1]));
+    pc = code + fixnum_value(pc[0]);
+    NEXT;
+  }
+  PUSH(fn);
+  pc += 2;
+  NEXT;
 
-cell_t *apply(scheme_ctx_t *ctx, cell_t *args)
-{
-  cell_t *arg[2] = {ctx->NIL, ctx->NIL};
-  if (!(is_pair(args))) {
-    printf("ERROR: apply needs an argument\n");
-  } else {
-    arg[0] = _car(args);
-    if (is_pair(_cdr(args))) {
-      if (!is_null(ctx, _car(_cdr(args))) && !is_pair(_car(_cdr(args)))) {
-        printf("ERROR: apply: argument 1 must be pair (or null)\n");
-        return ctx->NIL;
-      }
-      arg[1] = _car(_cdr(args));
+  /* n source, the callee and the arguments are on the stack */
+op_call:
+  in_tail = 0;
+  goto call;
+op_tail_call:
+  in_tail = 1;
+call:
+  n = fixnum_value(pc[0]);
+  base = SYNC() - n;
+  fn = STACK(base - 1);
+  pc += 2;
+  if (is_apply(fn)) {
+    int count = spread_apply(ctx, base, n);
+    if (count >= 0) {
+      fn = STACK(base - 1);
+      n = count;
+    }
+  }
+  if (in_tail && fn == STACK(fp - 1) && !ctx->frame->u.record.captured
+      && n == fixnum_value(record_slots(fn->u.lambda.proc)[PROC_NPARAMS])
+      && is_false(ctx, record_slots(fn->u.lambda.proc)[PROC_REST])) {
+    /* calls itself and no closure refers to its frame: take the frame
+     * over for the new arguments */
+    vm_reuse_frame(ctx, ctx->frame, base, n);
+    sp = ctx->roots + fp;
+    pc = code + 1;
+    NEXT;
+  }
+  if (is_lambda(fn) && has_code(fn)) {
+    frame = lambda_frame(ctx, fn, base, n);
+    sp = ctx->roots + base - 1;
+    if (!frame) {
+      PUSH(ctx->NIL);
+      NEXT;
     }
-    if (is_primop(arg[0])) {
-      return apply_primop(ctx, arg[0], arg[1]);
-    } else if (is_lambda(arg[0])) {
-      return apply_lambda(ctx, arg[0], arg[1], NULL, NULL);
+    if (in_tail) {
+      /* reuse the slots of the running lambda */
+      sp = ctx->roots + fp;
+      STACK(fp - 1) = fn;
     } else {
-      printf("ERROR: apply: cannot apply\n");
+      PUSH(ctx->frame);
+      PUSH(mk_fixnum(pc - code));
+      PUSH(mk_fixnum(fp));
+      PUSH(fn);
+      fp = sp - ctx->roots;
+      enter_call(ctx);
     }
+    ctx->frame = frame;
+    ENTER(fn);
+    NEXT;
   }
-  return ctx->NIL;
-}
+  if (in_tail && fp == entry && is_lambda(fn)) {
+    tail->lambda = fn;
+    tail->frame = lambda_frame(ctx, fn, base, n);
+    sp = ctx->roots + fp - VM_SAVED;
+    ctx->frame = sp[0];
+    SYNC();
+    return ctx->NIL;
+  }
+  a = apply_values(ctx, fn, base, n, pc[-1]);
+  sp = ctx->roots + base - 1;
+  PUSH(a);
+  NEXT;
 
-cell_t *eval_ex(scheme_ctx_t *ctx,
-    cell_t *obj,
-    cell_t *last_lambda,
-    cell_t **tail_recursion_args);
+op_return:
+  a = TOP;
+  sp = ctx->roots + fp - VM_SAVED;
+  ctx->frame = sp[0];
+  if (fp == entry) {
+    SYNC();
+    return a;
+  }
+  --ctx->depth;
+  n = fixnum_value(sp[1]);
+  fp = fixnum_value(sp[2]);
+  code = proc_code(STACK(fp - 1));
+  pc = code + n;
+  PUSH(a);
+  NEXT;
 
+  /* value, epoch, where the code computing it ends */
+op_folded:
+  if (fixnum_value(pc[1]) == ctx->builtin_epoch) {
+    PUSH(pc[0]);
+    pc = code + fixnum_value(pc[2]);
+    NEXT;
+  }
+  pc += 3;
+  NEXT;
+op_guard:
+  pc = fixnum_value(pc[0]) == ctx->builtin_epoch
+    ? pc + 2 : code + fixnum_value(pc[1]);
+  NEXT;
+op_flonum:
+  n = fixnum_value(pc[1]);
+  base = SYNC();
+  a = flonum_run(ctx, pc[0], &STACK(base - n));
+  sp = ctx->roots + base - n + 1;
+  TOP = a;
+  pc += 2;
+  NEXT;
 
-cell_t *apply_lambda(
-    scheme_ctx_t *ctx,
-    cell_t *lambda,
-    cell_t *args,
-    cell_t *last_lambda,
-    cell_t **tail_recursion_args)
-{
-  if (lambda == last_lambda && tail_recursion_args) {
-    /* TAIL RECURSION: */
-    /* evaluate arguments and return to caller */
-    *tail_recursion_args = eval_list(ctx, args);
-    return ctx->NIL;
+  /* an overflow goes to the primop, which makes a bignum */
+op_add:
+  OVERFLOW_OP(PRIM_ADD, fixnum_add_overflow);
+op_sub:
+  OVERFLOW_OP(PRIM_SUB, fixnum_sub_overflow);
+op_mul:
+  OVERFLOW_OP(PRIM_MUL, fixnum_mul_overflow);
+op_modulo:
+  if (is_fixnum(TOP) && fixnum_value(TOP) != 0 && fixnum_value(TOP) != -1) {
+    FIXNUM_OP(PRIM_MODULO, mk_fixnum(x % y));
   }
-  cell_t *old_env = ctx->env;  /* XXX */
-  int old_sink_pos = ctx->sink_pos;
-  cell_t *rec = NULL;
-  cell_t *vars  = args;
-  cell_t *ret;
+  SLOW(2);
+op_num_eq:
+  FIXNUM_OP(PRIM_NUM_EQ, x == y ? ctx->TRUE : ctx->FALSE);
+op_lt:
+  FIXNUM_OP(PRIM_LT, x < y ? ctx->TRUE : ctx->FALSE);
+op_gt:
+  FIXNUM_OP(PRIM_GT, x > y ? ctx->TRUE : ctx->FALSE);
+op_lt_eq:
+  FIXNUM_OP(PRIM_LT_EQ, x <= y ? ctx->TRUE : ctx->FALSE);
+op_gt_eq:
+  FIXNUM_OP(PRIM_GT_EQ, x >= y ? ctx->TRUE : ctx->FALSE);
+op_eq:
+  if (BUILTIN(PRIM_EQ)) {
+    sp -= 1;
+    TOP = *sp == TOP ? ctx->TRUE : ctx->FALSE;
+    pc += 2;
+    NEXT;
+  }
+  SLOW(2);
+op_cons:
+  if (BUILTIN(PRIM_CONS)) {
+    base = SYNC();
+    a = cons(ctx, STACK(base - 2), STACK(base - 1));
+    sp = ctx->roots + base - 1;
+    TOP = a;
+    pc += 2;
+    NEXT;
+  }
+  SLOW(2);
+op_car:
+  if (is_pair(TOP) && BUILTIN(PRIM_CAR)) {
+    TOP = _car(TOP);
+    pc += 2;
+    NEXT;
+  }
+  SLOW(1);
+op_cdr:
+  if (is_pair(TOP) && BUILTIN(PRIM_CDR)) {
+    TOP = _cdr(TOP);
+    pc += 2;
+    NEXT;
+  }
+  SLOW(1);
 
-  do {
-    cell_t *names = lambda->u.lambda.names;
-    cell_t *body  = lambda->u.lambda.body;
-    if (is_pair(names)) {
-      for( ;
-          !is_null(ctx, names) && !is_null(ctx, vars);
-          names = _cdr(names), vars = _cdr(vars)) {
-        /* when in TAIL RECURSION arguments are already evaluated ... */
-        if (rec) {
-          env_define(ctx, _car(names), _car(vars));
-        } else {
-          env_define(ctx, _car(names), eval(ctx, _car(vars)));
-        }
-      }
-    } else {
-      if (rec) {
-        env_define(ctx, names, vars);
-      } else {
-        env_define(ctx, names, eval_list(ctx, vars));
-      }
-    }
-    rec = NULL;
-    ret = eval_ex(ctx, body, lambda, &rec);
-    if (rec) {
-      /* TAIL RECURSION */
-      vars = rec;
-      ctx->args = vars; /* for gc */
-      ctx->result = ret; /* for gc */
-    } else {
-      ctx->args = ctx->NIL;
-    }
-    ctx->env = old_env;  /* XXX */
-    ctx->sink_pos = old_sink_pos; /*XXX  */
-  } while(rec);
-  return ret;
+  /* compare the two values on top, go on after the operands if it holds,
+   * otherwise jump */
+op_branch_num_eq:
+  BRANCH_OP(PRIM_NUM_EQ, is_fixnum(sp[-2]) && is_fixnum(TOP), x == y);
+op_branch_lt:
+  BRANCH_OP(PRIM_LT, is_fixnum(sp[-2]) && is_fixnum(TOP), x < y);
+op_branch_gt:
+  BRANCH_OP(PRIM_GT, is_fixnum(sp[-2]) && is_fixnum(TOP), x > y);
+op_branch_lt_eq:
+  BRANCH_OP(PRIM_LT_EQ, is_fixnum(sp[-2]) && is_fixnum(TOP), x <= y);
+op_branch_gt_eq:
+  BRANCH_OP(PRIM_GT_EQ, is_fixnum(sp[-2]) && is_fixnum(TOP), x >= y);
+op_branch_eq:
+  BRANCH_OP(PRIM_EQ, 1, sp[0] == sp[1]);
+branch_slow:
+  SYNC();
+  vm_call_global(ctx, pc[0], 2, pc[1]);
+  RELOAD();
+  sp -= 1;
+  pc = is_false(ctx, *sp) ? code + fixnum_value(pc[2]) : pc + 3;
+  NEXT;
+
+#undef NEXT
+#undef SYNC
+#undef RELOAD
+#undef STACK
+#undef TOP
+#undef PUSH
+#undef PUSH_NEW
+#undef ENTER
+#undef BUILTIN
+#undef SLOW
+#undef FIXNUM_OP
+#undef OVERFLOW_OP
+#undef BRANCH_OP
 }
 
+/* ---------------t main .. */
 
-cell_t *eval(scheme_ctx_t *ctx, cell_t *obj)
-{
-  return eval_ex(ctx, obj, NULL, NULL);
-}
-cell_t *eval_ex(
-    scheme_ctx_t *ctx,
-    cell_t       *obj,
-    cell_t       *last_lambda,
-    cell_t      **tail_recursion_args)
-{
-  cell_t *ret = ctx->NIL;
-  int old_sink_pos = ctx->sink_pos;
+#define ANY CELL_T_EMPTY
+#define INT CELL_T_INTEGER
+#define FLO CELL_T_FLONUM
+#define NUM CELL_T_NUMBER
+#define PAIR CELL_T_PAIR
+#define VEC CELL_T_VECTOR
+#define BYTES CELL_T_BYTEVECTOR
+#define HASH CELL_T_HASHTABLE
+#define STR CELL_T_STRING
+#define VARIADIC PRIMOP_VARIADIC
+static const primop_t primops[] = {
+  {"eq?", &eq, 2, 2},
+  {"eqv?", &eqv, 2, 2},
+  {"string=?", &string_eq, 2, 2, {STR, STR}},
+  {"apply", &apply, 1, 2},
+  {"eval", &eval_primop, 1, 1},
+  {"write", &write_primop, 1, 1},
+  {"display", &display, 1, 1},
+  {"newline", &newline, 0, VARIADIC},
+  {"flush-output", &flush_output, 0, VARIADIC},
+  {"gc-info", &gc_info_primop, 0, VARIADIC},
+  {"current-jiffy", &current_jiffy, 0, 0},
+  {"jiffies-per-second", &jiffies_per_second, 0, 0},
+  {"disassemble", &disassemble, 1, 1},
+  {"cons", &primop_cons, 2, 2},
+  {"length", &primop_length, 1, 1},
+  {"car", &car, 1, 1, {PAIR}},
+  {"cdr", &cdr, 1, 1, {PAIR}},
+  {"set-car!", &set_car, 2, 2, {PAIR, ANY}},
+  {"set-cdr!", &set_cdr, 2, 2, {PAIR, ANY}},
 
-  if (is_null(ctx, obj)) {
-    printf("error try to apply NULL\n");
-  } else if (!is_pair(obj)) {
-    if (is_sym(obj)) {
-      ret = env_resolve(ctx, obj);
-    } else {
-      ret = obj;
-    }
-  } else if (is_sym(_car(obj))) {
-    cell_t *cmd = _car(obj);
-    cell_t *args = _cdr(obj);
-    if (cmd == ctx->SYMBOL_IF) {
-      /* (if a b c) */
-      if (list_length(args) != 3) {
-        printf("ERROR: 'if' requires 3 arguments\n");
-      } else {
-        cell_t *a = _car(args);
-        cell_t *b = _car(_cdr(args));
-        cell_t *c = _car(_cdr(_cdr(args)));
-        if (is_true(ctx, eval(ctx, a))) {
-          ret = eval_ex(ctx, b, last_lambda, tail_recursion_args);
-        } else {
-          ret = eval_ex(ctx, c, last_lambda, tail_recursion_args);
-        }
-      }
-    } else if (cmd == ctx->SYMBOL_MACRO) {
-      int arg_cnt = list_length(args);
-      if (arg_cnt == 2) {
-        cell_t *arg0 = _car(args); /* name + arg */
-        cell_t *macro_body = _car(_cdr(args)); /* body */
-
-        arg_cnt = list_length(arg0);
-        if (arg_cnt == 2) {
-          cell_t *macro_name = _car(arg0);
-          cell_t *macro_arg = _car(_cdr(arg0));
-          if (!is_sym(macro_name)) {
-            printf("ERROR: macro name must be a symbol\n");
-          } else if(!is_sym(macro_arg)) {
-            printf("ERROR: macro argument must be a symbol\n");
-          } else {
-            ret = env_define(ctx, macro_name,
-                mk_macro(ctx, macro_arg, macro_body));
-          }
-        } else {
-          printf("ERROR: macro illegal parameter 1, must be pair with 2 elements\n");
-        }
-      } else {
-        printf("ERROR: macro needs 2 arguments\n");
-      }
-    } else if (cmd == ctx->SYMBOL_DEFINE) {
-      if (list_length(args) != 2) {
-        printf("ERROR: 'define' requites 2 arguments\n");
-      } else {
-        cell_t *name = _car(args);
-        cell_t *value = _car(_cdr(args));
-        if (!is_sym(name)) {
-          printf("ERROR: define: name is not a symbol\n");
-        } else {
-          ret = env_define(ctx, name, eval(ctx, value));
-        }
-      }
-    } else if (cmd == ctx->SYMBOL_LAMBDA) {
-      ret = mk_lambda(ctx, args);
-    } else if (cmd == ctx->SYMBOL_QUOTE) {
-      ret = _car(args);
-    } else if (cmd == ctx->SYMBOL_QUASIQUOTE) {
-      ret = eval_quasiquote(ctx, args);
-    } else if (cmd == ctx->SYMBOL_BEGIN) {
-      while( !is_null(ctx, args)) {
-        if (is_null(ctx, _cdr(args))) {
-          ret = eval_ex(ctx, _car(args), last_lambda, tail_recursion_args);
-        } else {
-          ret = eval(ctx, _car(args));
-        }
-        args = _cdr(args);
-      }
-    } else {
-      /* try to resolve symbol */
-      cell_t *resolved_cmd = env_resolve(ctx, cmd);
-      if (is_null(ctx, resolved_cmd)) {
-        /* ERROR */
-      } else if (is_primop(resolved_cmd)) {
-        ret = apply_primop(ctx, resolved_cmd, eval_list(ctx, args));
-      } else if (is_lambda(resolved_cmd)) {
-        ret = apply_lambda(ctx, resolved_cmd, args, last_lambda, tail_recursion_args);
-      } else if (is_macro(resolved_cmd)) {
-        ret = apply_macro(ctx, resolved_cmd, cons(ctx, resolved_cmd, args));
-      }
-    }
-  } else if(is_pair(_car(obj))) {
-    ret = eval_ex (ctx, _car(obj), last_lambda, tail_recursion_args);
-    if (is_lambda(ret)) {
-      ret = apply_lambda(ctx, ret, _cdr(obj), last_lambda, tail_recursion_args);
-    } else if (is_macro(ret)) {
-      ret = apply_macro(ctx, ret, obj);
-    }
-  } else if(is_lambda(_car(obj))){
-    cell_t *cmd = _car(obj);
-    cell_t *args = _cdr(obj);
-    ret = apply_lambda(ctx, cmd, args, last_lambda, tail_recursion_args);
-  } else if(is_macro(_car(obj))) {
-    ret = apply_macro(ctx, _car(obj), obj);
-  } else if(is_primop(_car(obj))) {
-    ret = apply_primop(ctx, _car(obj), _cdr(obj));
-  } else {
-    printf("cannot apply\n");
-    print_obj(ctx, obj);
-    printf("\n");
-  }
-  ctx->result = ret; /* keep result from being GCed */
-  ctx->sink_pos = old_sink_pos;
-  return ret;
-}
+  {"+", &op_plus, 0, VARIADIC, {NUM, NUM}, NUM},
+  {"-", &op_minus, 1, VARIADIC, {NUM, NUM}, NUM},
+  {"*", &op_mul, 0, VARIADIC, {NUM, NUM}, NUM},
+  {"/", &op_div, 1, VARIADIC, {NUM, NUM}, NUM},
+  {"modulo", &modulo, 2, 2, {INT, INT}},
+
+  {"=", &integer_eq, 2, 2, {NUM, NUM}},
+  {">", &op_gt, 2, 2, {NUM, NUM}},
+  {"<", &op_lt, 2, 2, {NUM, NUM}},
+  {">=", &op_gt_eq, 2, 2, {NUM, NUM}},
+  {"<=", &op_lt_eq, 2, 2, {NUM, NUM}},
+
+  {"fl+", &fl_add, 0, VARIADIC, {FLO, FLO}, FLO},
+  {"fl-", &fl_sub, 1, VARIADIC, {FLO, FLO}, FLO},
+  {"fl*", &fl_mul, 0, VARIADIC, {FLO, FLO}, FLO},
+  {"fl/", &fl_div, 1, VARIADIC, {FLO, FLO}, FLO},
+  {"fl=", &fl_eq, 2, 2, {FLO, FLO}},
+  {"fl<", &fl_lt, 2, 2, {FLO, FLO}},
+  {"fl>", &fl_gt, 2, 2, {FLO, FLO}},
+  {"fl<=", &fl_lt_eq, 2, 2, {FLO, FLO}},
+  {"fl>=", &fl_gt_eq, 2, 2, {FLO, FLO}},
+  {"inexact", &inexact, 1, 1, {NUM}},
+  {"exact->inexact", &inexact, 1, 1, {NUM}},
+  {"exact", &exact, 1, 1, {NUM}},
+  {"inexact->exact", &exact, 1, 1, {NUM}},
+
+  {"make-vector", &make_vector, 1, 2, {INT, ANY}},
+  {"vector", &vector, 0, VARIADIC},
+  {"vector-length", &vector_length_primop, 1, 1, {VEC}},
+  {"vector-ref", &vector_ref_primop, 2, 2, {VEC, INT}},
+  {"vector-set!", &vector_set_primop, 3, 3, {VEC, INT}},
+  {"vector-fill!", &vector_fill, 2, 4, {VEC, ANY}, INT},
+  {"vector-copy", &vector_copy, 1, 3, {VEC, INT}, INT},
+  {"vector-map", &vector_map, 2, VARIADIC, {ANY, VEC}, VEC},
+  {"vector->list", &vector_to_list, 1, 1, {VEC}},
+  {"list->vector", &list_to_vector_primop, 1, 1},
+
+  {"make-bytevector", &make_bytevector, 1, 2, {INT, INT}},
+  {"bytevector", &bytevector, 0, VARIADIC, {INT, INT}, INT},
+  {"bytevector-length", &bytevector_length, 1, 1, {BYTES}},
+  {"bytevector-u8-ref", &bytevector_ref, 2, 2, {BYTES, INT}},
+  {"bytevector-u8-set!", &bytevector_set, 3, 3, {BYTES, INT}, INT},
+  {"bytevector-copy", &bytevector_copy, 1, 3, {BYTES, INT}, INT},
+  {"bytevector-copy!", &bytevector_copy_to, 3, 5, {BYTES, INT}},
+  {"bytevector-fill!", &bytevector_fill, 2, 4, {BYTES, INT}, INT},
+  {"bytevector-compare", &bytevector_compare, 2, 2, {BYTES, BYTES}},
+  {"bytevector=?", &bytevector_equal, 2, 2, {BYTES, BYTES}},
+  {"bytevector-index", &bytevector_index, 2, 4, {BYTES, ANY}, INT},
+  {"bytevector-sum", &bytevector_sum, 1, 3, {BYTES, INT}, INT},
+  {"bytevector-xor!", &bytevector_xor, 2, 2, {BYTES, BYTES}},
+  {"bytevector-adler32", &bytevector_adler32, 1, 3, {BYTES, INT}, INT},
+  {"bytevector->list", &bytevector_to_list, 1, 1, {BYTES}},
+  {"list->bytevector", &list_to_bytevector_primop, 1, 1},
+
+  {"make-hash-table", &make_hash_table, 0, 1},
+  {"hash-table?", &hash_table_p, 1, 1},
+  {"hash-table-ref", &hash_table_ref, 2, 3, {HASH, ANY}},
+  {"hash-table-ref/default", &hash_table_ref_default, 3, 3, {HASH, ANY}},
+  {"hash-table-set!", &hash_table_set, 3, 3, {HASH, ANY}},
+  {"hash-table-delete!", &hash_table_delete, 2, 2, {HASH, ANY}},
+  {"hash-table-contains?", &hash_table_contains, 2, 2, {HASH, ANY}},
+  {"hash-table-count", &hash_table_count, 1, 1, {HASH}},
+  {"hash-table-update!/default", &hash_table_update, 4, 4, {HASH, ANY}},
+  {"hash-table-walk", &hash_table_walk, 2, 2, {HASH, ANY}},
+  {"hash-table-keys", &hash_table_keys, 1, 1, {HASH}},
+  {"hash-table-values", &hash_table_values, 1, 1, {HASH}},
+  {"hash-table->alist", &hash_table_to_alist, 1, 1, {HASH}},
+};
+#undef ANY
+#undef INT
+#undef FLO
+#undef NUM
+#undef PAIR
+#undef VEC
+#undef BYTES
+#undef HASH
+#undef STR
+#undef VARIADIC
 
-/* ---------------t main .. */
 void scheme_init(scheme_ctx_t *ctx) {
   memset(ctx, 0, sizeof(*ctx));
-  ctx->memory_size = 1024 * 16; /* 16k memory-cells */
-  ctx->NIL = &ctx->NIL_VALUE;
-  ctx->TRUE = &ctx->TRUE_VALUE;
-  ctx->FALSE = &ctx->FALSE_VALUE;
-  ctx->sink_pos = 0;
+  ctx->memory_max = (size_t)-1;
+  ctx->live_ratio = DEFAULT_LIVE_RATIO;
+  ctx->gc_quantum = DEFAULT_GC_QUANTUM;
+  ctx->max_depth = DEFAULT_MAX_DEPTH;
+  ctx->memory_min = DEFAULT_HEAP_SIZE / sizeof(cell_t);
+  if (heap_grow(ctx, ctx->memory_min)) {
+    printf("out of memory\n");
+    exit(1);
+  }
+  ctx->gc_threshold = ctx->memory_size - SEGMENT_CELLS;
+  ctx->nursery = ctx->segments;
+  ctx->mark_stack = malloc(sizeof(cell_t *) * MARK_STACK_SIZE);
+  ctx->alloc_ptr = ctx->alloc_limit = ctx->nursery->cells;
+  ctx->NIL = CONSTANT_NIL;
+  ctx->TRUE = CONSTANT_TRUE;
+  ctx->FALSE = CONSTANT_FALSE;
   ctx->syms = ctx->NIL;
-  ctx->env = ctx->NIL;
+  symtab_grow(ctx);
+  ctx->frame = ctx->NIL;
   ctx->code = ctx->NIL;
-  ctx->result = ctx->NIL;
-  ctx->args = ctx->NIL;
-  ctx->memory = calloc(1, sizeof(cell_t) * ctx->memory_size);
   /* init tokenizer for stdin */
   tokenizer_init_stdio(&ctx->tokenizer_ctx, stdin);
+  bytes_init();
 
   ctx->PARENTHESIS_OPEN = mk_symbol(ctx, "(");
   ctx->PARENTHESIS_CLOSE = mk_symbol(ctx, ")");
@@ -1084,39 +5814,116 @@ void scheme_init(scheme_ctx_t *ctx) {
   ctx->SYMBOL_UNQUOTE_ALIAS = mk_symbol(ctx, ",");
   ctx->SYMBOL_UNQUOTE_SPLICE = mk_symbol(ctx, "unquote-splice");
   ctx->SYMBOL_UNQUOTE_SPLICE_ALIAS = mk_symbol(ctx, ",@");
+  ctx->VECTOR_OPEN = mk_symbol(ctx, "#(");
+  ctx->BYTEVECTOR_PREFIX = mk_symbol(ctx, "#u8");
   ctx->SYMBOL_MACRO = mk_symbol(ctx, "macro");
 
   env_define(ctx, mk_symbol(ctx, "#t"), ctx->TRUE);
   env_define(ctx, mk_symbol(ctx, "#f"), ctx->FALSE);
-  env_define(ctx, mk_symbol(ctx, "eq?"), mk_primop(ctx, &eq));
-  env_define(ctx, mk_symbol(ctx, "apply"), mk_primop(ctx, &apply));
-  env_define(ctx, mk_symbol(ctx, "eval"), mk_primop(ctx, &eval_primop));
-  env_define(ctx, mk_symbol(ctx, "write"), mk_primop(ctx, &write_primop));
-  env_define(ctx, mk_symbol(ctx, "display"), mk_primop(ctx, &display));
-  env_define(ctx, mk_symbol(ctx, "newline"), mk_primop(ctx, &newline));
-  env_define(ctx, mk_symbol(ctx, "flush-output"), mk_primop(ctx, &flush_output));
-  env_define(ctx, mk_symbol(ctx, "cons"), mk_primop(ctx, &primop_cons));
-  env_define(ctx, mk_symbol(ctx, "length"), mk_primop(ctx, &primop_length));
-  env_define(ctx, mk_symbol(ctx, "car"), mk_primop(ctx, &car));
-  env_define(ctx, mk_symbol(ctx, "cdr"), mk_primop(ctx, &cdr));
-
-  env_define(ctx, mk_symbol(ctx, "+"), mk_primop(ctx, &op_plus));
-  env_define(ctx, mk_symbol(ctx, "-"), mk_primop(ctx, &op_minus));
-  env_define(ctx, mk_symbol(ctx, "*"), mk_primop(ctx, &op_mul));
-  env_define(ctx, mk_symbol(ctx, "/"), mk_primop(ctx, &op_div));
-  env_define(ctx, mk_symbol(ctx, "modulo"), mk_primop(ctx, &modulo));
-
-  env_define(ctx, mk_symbol(ctx, "="), mk_primop(ctx, &integer_eq));
-  env_define(ctx, mk_symbol(ctx, ">"), mk_primop(ctx, &op_gt));
-  env_define(ctx, mk_symbol(ctx, "<"), mk_primop(ctx, &op_lt));
-  env_define(ctx, mk_symbol(ctx, ">="), mk_primop(ctx, &op_gt_eq));
-  env_define(ctx, mk_symbol(ctx, "<="), mk_primop(ctx, &op_lt_eq));
-  ctx->sink_pos = 0;
-  gc_collect(ctx, ctx->NIL, ctx->NIL);
+  for (size_t i = 0; i < sizeof(primops) / sizeof(primops[0]); ++i) {
+    env_define(ctx, mk_symbol(ctx, primops[i].name),
+        mk_primop(ctx, &primops[i]));
+  }
+  ctx->roots_pos = 0;
+  gc_collect(ctx);
   /* debug output */
   gc_info(ctx);
 }
 
+/* Embedding API: set the initial and the maximum heap size in bytes and the
+ * percentage of live cells the heap is sized for after a full collection.
+ * Zero keeps the current value. */
+void scheme_set_heap_size(scheme_ctx_t *ctx, size_t initial, size_t max,
+    int live_ratio)
+{
+  if (max) {
+    ctx->memory_max = max / sizeof(cell_t);
+  }
+  if (initial) {
+    ctx->memory_min = initial / sizeof(cell_t);
+  }
+  if (ctx->memory_min > ctx->memory_max) {
+    ctx->memory_min = ctx->memory_max;
+  }
+  if (live_ratio > 0 && live_ratio < 100) {
+    ctx->live_ratio = live_ratio;
+  }
+  heap_grow(ctx, ctx->memory_min);
+  if (ctx->memory_size > ctx->gc_threshold + SEGMENT_CELLS) {
+    ctx->gc_threshold = ctx->memory_size - SEGMENT_CELLS;
+  }
+}
+
+/* Embedding API: spread full collections over many short steps of 'quantum'
+ * cells each (0 keeps the current quantum) instead of stopping the program
+ * for a whole collection. */
+void scheme_set_incremental_gc(scheme_ctx_t *ctx, int incremental,
+    size_t quantum)
+{
+  if (quantum) {
+    ctx->gc_quantum = quantum < GC_MARK_RATIO ? GC_MARK_RATIO : quantum;
+  }
+  if (!incremental && ctx->gc_phase != GC_IDLE) {
+    gc_collect(ctx);
+  }
+  ctx->gc_incremental = incremental;
+}
+
+/* Embedding API: choose what runs lambdas defined from now on. */
+void scheme_set_engine(scheme_ctx_t *ctx, enum engine_e engine)
+{
+  ctx->engine = engine;
+}
+
+/* Embedding API: print the body of every lambda after optimize(), to see
+ * what was inlined and folded. */
+void scheme_set_print_optimized(scheme_ctx_t *ctx, int print_optimized)
+{
+  ctx->print_optimized = print_optimized;
+}
+
+/* Embedding API: how many calls may be in progress (0 keeps the current
+ * limit). */
+void scheme_set_max_depth(scheme_ctx_t *ctx, size_t max_depth)
+{
+  if (max_depth) {
+    ctx->max_depth = max_depth;
+  }
+}
+
+/* read and evaluate forms until EOF, an error only aborts the current form */
+static void scheme_run(scheme_ctx_t *ctx, int print_results)
+{
+  char base;
+  struct rlimit limit;
+  size_t c_stack = DEFAULT_C_STACK;
+  if (!getrlimit(RLIMIT_STACK, &limit) && limit.rlim_cur != RLIM_INFINITY) {
+    c_stack = limit.rlim_cur;
+  }
+  /* the stack in use below here belongs to the caller */
+  ctx->c_stack_base = &base;
+  ctx->c_stack_limit = c_stack / 100 * C_STACK_SHARE;
+  ctx->error_jmp_set = 1;
+  if (setjmp(ctx->error_jmp)) {
+    ctx->frame = ctx->NIL;
+    ctx->depth = 0;
+  }
+  for (;;) {
+    ctx->roots_pos = 0;
+    roots_release(ctx);
+    cell_t *obj = get_object(ctx);
+    if (!obj) {
+      break;
+    }
+    cell_t *ret = eval(ctx, analyze(ctx, obj, NULL));
+    if (print_results) {
+      print_obj(ctx, ret);
+      printf("\n");
+    }
+  }
+  ctx->error_jmp_set = 0;
+}
+
 #if 0
 void scheme_load_memory(scheme_ctx_t *ctx, char *memory, size_t len)
 {
@@ -1126,7 +5933,7 @@ void scheme_load_memory(scheme_ctx_t *ctx, char *memory, size_t len)
   data.memory = memory;
   tokenizer_init(&ctx->tokenizer_ctx, memory_get_char, &data);
   for (cell_t *obj = get_object(ctx); obj; obj=get_object(ctx)) {
-    eval(ctx, obj);
+    eval(ctx, analyze(ctx, obj, NULL));
   }
 }
 #endif
@@ -1139,26 +5946,93 @@ void scheme_load_file(scheme_ctx_t *ctx, char *filename)
     return;
   }
   tokenizer_init_stdio(&ctx->tokenizer_ctx, fd);
+  scheme_run(ctx, 0);
+  fclose(fd);
+}
 
-  for (cell_t *obj = get_object(ctx); obj; obj=get_object(ctx)) {
-    eval(ctx, obj);
+/* sizes may carry a k, m or g suffix */
+static size_t parse_size(char *str)
+{
+  char *rest = NULL;
+  size_t ret = strtoull(str, &rest, 10);
+  switch (*rest) {
+    case 'g': case 'G':
+      ret *= 1024;
+      /* fall through */
+    case 'm': case 'M':
+      ret *= 1024;
+      /* fall through */
+    case 'k': case 'K':
+      ret *= 1024;
+      break;
+    default:
+      break;
   }
-  fclose(fd);
+  return ret;
 }
 
 int main(int argc, char *argv[])
 {
   scheme_ctx_t ctx;
+  char *filename = NULL;
+  size_t heap_size = 0;
+  size_t max_heap_size = 0;
+  int live_ratio = 0;
+  int incremental_gc = 0;
+  size_t gc_quantum = 0;
+  enum engine_e engine = ENGINE_VM;
+  size_t max_depth = 0;
+  int print_optimized = 0;
+  char *bytes_kernels = NULL;
+
+  for (int i = 1; i < argc; ++i) {
+    if (!strncmp(argv[i], "--heap-size=", 12)) {
+      heap_size = parse_size(argv[i] + 12);
+    } else if (!strncmp(argv[i], "--max-heap-size=", 16)) {
+      max_heap_size = parse_size(argv[i] + 16);
+    } else if (!strncmp(argv[i], "--live-ratio=", 13)) {
+      live_ratio = atoi(argv[i] + 13);
+    } else if (!strcmp(argv[i], "--incremental-gc")) {
+      incremental_gc = 1;
+    } else if (!strncmp(argv[i], "--gc-quantum=", 13)) {
+      incremental_gc = 1;
+      gc_quantum = parse_size(argv[i] + 13);
+    } else if (!strcmp(argv[i], "--engine=vm")) {
+      engine = ENGINE_VM;
+    } else if (!strcmp(argv[i], "--engine=ast")) {
+      engine = ENGINE_AST;
+    } else if (!strncmp(argv[i], "--max-depth=", 12)) {
+      max_depth = parse_size(argv[i] + 12);
+    } else if (!strcmp(argv[i], "--print-optimized")) {
+      print_optimized = 1;
+    } else if (!strncmp(argv[i], "--bytes-kernels=", 16)) {
+      bytes_kernels = argv[i] + 16;
+    } else if (argv[i][0] == '-' && argv[i][1] == '-') {
+      printf("usage: %s [--heap-size=SIZE] [--max-heap-size=SIZE] "
+          "[--live-ratio=PERCENT] [--incremental-gc] [--gc-quantum=CELLS] "
+          "[--engine=vm|ast] [--max-depth=CALLS] [--print-optimized] "
+          "[--bytes-kernels=avx2|sse2|portable] [file]\n", argv[0]);
+      return 1;
+    } else {
+      filename = argv[i];
+    }
+  }
+
   scheme_init(&ctx);
+  scheme_set_heap_size(&ctx, heap_size, max_heap_size, live_ratio);
+  scheme_set_incremental_gc(&ctx, incremental_gc, gc_quantum);
+  scheme_set_engine(&ctx, engine);
+  scheme_set_max_depth(&ctx, max_depth);
+  scheme_set_print_optimized(&ctx, print_optimized);
+  if (bytes_kernels && bytes_use(bytes_kernels)) {
+    printf("no %s kernels on this CPU\n", bytes_kernels);
+    return 1;
+  }
 
-  if (argc == 2) {
-    scheme_load_file(&ctx, argv[1]);
+  if (filename) {
+    scheme_load_file(&ctx, filename);
   } else {
-    cell_t *obj;
-    while((obj = get_object(&ctx))) {
-      print_obj(&ctx, eval(&ctx, obj));
-      printf("\n");
-    }
+    scheme_run(&ctx, 1);
   }
 
 #if 0
@@ -1167,7 +6041,7 @@ int main(int argc, char *argv[])
     for (cell_t *t = ctx.sink; is_pair(t); t = _cdr(t)) {
       printf("sink: %s ", get_type_name(_car(t)->type));
       if (is_sym(_car(t))) {
-        printf("%s", _car(t)->u.symbol);
+        printf("%s", _car(t)->u.symbol.name);
       }
       printf("\n");
     }
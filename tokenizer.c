@@ -56,7 +56,7 @@ static void tokenizer_init(tokenizer_ctx_t *ctx, char (*get_char)(void*), void *
 int match_special(char *buf, int pos, int next)
 {
   static char *tokens[] = {
-    "(", ")", ",", "'", "`", "\"", " ", "\n", ",@", NULL
+    "(", ")", ",", "'", "`", "\"", " ", "\n", ",@", "#(", NULL
   };
   int ret = 0;
   if (pos == 2) {
@@ -72,18 +72,18 @@ int match_special(char *buf, int pos, int next)
       if (strlen(tokens[i]) == 1 && buf[0] == *tokens[i]) {
         /* semi match */
         ret = 1;
-      } else if (strlen(tokens[i]) == 2 && buf[0] == *tokens[i] && ret) {
+      } else if (strlen(tokens[i]) == 2 && buf[0] == *tokens[i]) {
         if (tokens[i][1] == next) {
           /* will completed in next call */
-          ret = 0;
-          break;
+          return 0;
         }
       }
     }
   }
   if (pos && !ret) {
+    /* '#' only starts a token at the start of one */
     for (int i = 0; tokens[i]; ++i) {
-      if (next == *tokens[i]) {
+      if (next == *tokens[i] && next != '#') {
         ret = 1;
         break;
       }
@@ -98,7 +98,8 @@ char *tokenizer_get_token(tokenizer_ctx_t *ctx)
   for (;;) {
 
     if (ctx->next_char != 0) {
-      if (ctx->token_buf_pos >= ctx->token_buf_size) {
+      /* keep room for the terminating '\0' */
+      if (ctx->token_buf_pos + 1 >= ctx->token_buf_size) {
         ctx->token_buf_size *= 2;
         ctx->token_buf = realloc(ctx->token_buf, ctx->token_buf_size);
       }